@@ -1,13 +1,312 @@
-#include <ADUC841.H>
+#include "hal.h"
 #include "typedef.h"
 #include "adc_interactions.h"
+#include "profile.h"
 
 // Global struct to store adc values
-ADC adc;
+ADC xdata adc;
+
+// Ring buffer written by the adc interrupt and read by the measurement code.
+// The ISR only moves adc_head and the foreground only moves adc_tail,
+// both are single bytes so reading them is atomic on the 8051.
+uint16 xdata adc_buf[ADC_BUF_SIZE];
+uint8 	adc_head;			// next slot the ISR writes to
+uint8 	adc_tail;			// next slot the foreground reads from
+uint8 idata adc_channel;	// channel being converted, ADC_NO_CHANNEL when stopped
+uint8 	adc_sink;			// ADC_SINK_ destination of each conversion
+uint16 idata adc_overruns;	// samples lost because the buffer was full
+uint32 idata adc_sum;		// sum of every oversampled result since it was last cleared
+uint32 idata adc_sum_count;	// number of oversampled results in adc_sum
+bit		adc_window_open;	// ADC_SINK_SQUARES only accumulates while set
+bit		adc_window_reset;	// clear the square sums before the next conversion
+uint16 idata adc_ref;		// deviations are taken from here
+int32 idata adc_dev_sum;	// sum of deviations
+uint32 idata adc_sq_lo;		// 48-bit sum of squared deviations
+uint16 idata adc_sq_hi;
+uint16	adc_peak_min;		// extremes of the window in ADC_SINK_PEAK
+uint16	adc_peak_max;
+uint8 xdata adc_scan_list[ADC_SCAN_MAX];	// channels converted in turn by ADC_SINK_SCAN
+uint8 idata adc_scan_count;	// channels in adc_scan_list
+uint8 idata adc_scan_index;	// channel selected for the next conversion
+uint16 xdata adc_scan_table[ADC_SCAN_CHANNELS];
+uint16 idata adc_scan_seen;
+uint8 xdata adc_filter;		// ADC_FILTER_ applied to each oversampled result
+bit		adc_median;			// median of 3 applied to each oversampled result
+bit		adc_filter_reset;	// restart the filters from the next result
+uint16 xdata adc_filtered;	// latest filter output
+uint16 xdata adc_med_a;		// the two results before the latest, for the median
+uint16 xdata adc_med_b;
+uint32 xdata adc_iir;		// IIR output scaled up by 2^ADC_IIR_SHIFT
+uint32 xdata adc_ma_sum;	// sum of adc_ma_ring
+uint16 xdata adc_ma_ring[ADC_MA_SIZE]; // last results, for the moving average
+uint8 xdata adc_ma_index;	// oldest entry in adc_ma_ring
+uint16 xdata *adc_capture_ring;	// where ADC_SINK_CAPTURE writes
+uint16	adc_capture_index;	// next slot of the ring
+uint16	adc_capture_fill;	// pre-trigger samples still to take before the trigger is armed
+uint16	adc_capture_left;	// samples still to take after the trigger, 0 until it fires
+uint16	adc_capture_level;	// trigger level in counts
+uint16 idata adc_capture_pre;	// samples kept from before the trigger
+uint8	adc_capture_edge;	// ADC_EDGE_ to trigger on
+uint8	adc_capture_side;	// 1 while the last sample was at or above the level
+bit		adc_capture_forced;	// trigger on the next sample whatever the level
+bit		adc_capture_ready;	// the ring is complete, conversions have stopped
+#if ADC_OVERSAMPLE_BITS > 0
+uint32	adc_block;			// conversions summed towards the next oversampled result
+uint16	adc_block_count;	// conversions in adc_block
+#endif
+
+
+// ADC interrupt, every finished conversion is pushed into the ring buffer or summed
+HAL_ISR_USING(adc_isr, 6, 1)
+{
+	uint8 next, high, channel;
+	int16 deviation;
+	uint16 magnitude, sample;
+	uint32 square;
+
+	PROF_ENTER_EVERY(PROF_ADC_ISR, PROF_ADC_EVERY);
+	if(adc_sink == ADC_SINK_CAPTURE)
+	{
+		if(adc_capture_ready)
+		{
+			PROF_EXIT_EVERY(PROF_ADC_ISR);
+			return;		// the conversion that was running when CCONV was cleared
+		}
+		// Read again if the next conversion landed between the two bytes, as in ADC_SINK_PEAK
+		high = ADCDATAH;
+		sample = ((high & 0x0F) << 8) | ADCDATAL;
+		if(high != ADCDATAH)
+		{
+			sample = ((ADCDATAH & 0x0F) << 8) | ADCDATAL;
+		}
+		adc_capture_ring[adc_capture_index] = sample;
+		adc_capture_index = (adc_capture_index + 1) & ADC_CAPTURE_MASK;
+
+		if(adc_capture_left == 0)
+		{
+			// The only test per sample while armed, the edge is a change of side towards it
+			high = sample >= adc_capture_level;
+			if(adc_capture_fill != 0)
+			{
+				adc_capture_fill--;
+			}
+			else if((high != adc_capture_side && high == adc_capture_edge) || adc_capture_forced)
+			{
+				adc_capture_left = ADC_CAPTURE_SIZE - adc_capture_pre;
+			}
+			adc_capture_side = high;
+		}
+
+		if(adc_capture_left != 0 && --adc_capture_left == 0)
+		{
+			ADCCON2 = 0x00;			// the ring is full around the trigger, stop converting
+			adc_capture_ready = 1;
+		}
+		PROF_EXIT_EVERY(PROF_ADC_ISR);
+		return;
+	}
+
+	if(adc_sink == ADC_SINK_SCAN)
+	{
+		// The top nibble says which channel this result is from
+		high = ADCDATAH;
+		channel = high >> 4;
+		if(channel < ADC_SCAN_CHANNELS)
+		{
+			magnitude = (((high & 0x0F) << 8) | ADCDATAL) << ADC_SCAN_FRAC_BITS;
+			if(adc_scan_seen & (1 << channel))
+			{
+				// Rounded, a truncated step stops up to 2 counts short of a rising input,
+				// this settles within a count either way
+				deviation = (int16) magnitude - (int16) adc_scan_table[channel];
+				adc_scan_table[channel] += (deviation + (1 << (ADC_SCAN_FILTER_SHIFT - 1))) >> ADC_SCAN_FILTER_SHIFT;
+			}
+			else
+			{
+				adc_scan_table[channel] = magnitude;	// first result, start the filter from it
+				adc_scan_seen |= 1 << channel;
+			}
+		}
+
+		// Select the next channel, conversions keep running with CCONV set
+		if(++adc_scan_index == adc_scan_count)
+		{
+			adc_scan_index = 0;
+		}
+		ADCCON2 = 0x20 | adc_scan_list[adc_scan_index];
+		PROF_EXIT_EVERY(PROF_ADC_ISR);
+		return;
+	}
+
+	if(adc_sink == ADC_SINK_PEAK)
+	{
+		if(!adc_window_open)
+		{
+			PROF_EXIT_EVERY(PROF_ADC_ISR);
+			return;
+		}
+		// A late ISR can read the high byte of one conversion and the low byte of the next,
+		// which one bad sample is enough to show in the peaks, so read again if it changed
+		high = ADCDATAH;
+		sample = ((high & 0x0F) << 8) | ADCDATAL;
+		if(high != ADCDATAH)
+		{
+			sample = ((ADCDATAH & 0x0F) << 8) | ADCDATAL;
+		}
+		if(adc_window_reset)
+		{
+			adc_window_reset = 0;
+			adc_peak_min = sample;	// first conversion of the window starts both extremes
+			adc_peak_max = sample;
+		}
+		else if(sample > adc_peak_max)
+		{
+			adc_peak_max = sample;
+		}
+		else if(sample < adc_peak_min)
+		{
+			adc_peak_min = sample;
+		}
+		PROF_EXIT_EVERY(PROF_ADC_ISR);
+		return;
+	}
+
+	if(adc_sink == ADC_SINK_SQUARES)
+	{
+		if(!adc_window_open)
+		{
+			PROF_EXIT_EVERY(PROF_ADC_ISR);
+			return;
+		}
+		if(adc_window_reset)
+		{
+			adc_window_reset = 0;
+			adc_dev_sum = 0;
+			adc_sq_lo = 0;
+			adc_sq_hi = 0;
+			adc_sum_count = 0;
+		}
+
+		deviation = (int16) (((ADCDATAH & 0x0F) << 8) | ADCDATAL) - (int16) adc_ref;
+		magnitude = deviation < 0 ? -deviation : deviation;
+		square = (uint32) magnitude * magnitude;
+
+		adc_dev_sum += deviation;
+		adc_sq_lo += square;
+		if(adc_sq_lo < square)
+		{
+			adc_sq_hi++;		// carry into the top 16 bits
+		}
+		adc_sum_count++;
+		PROF_EXIT_EVERY(PROF_ADC_ISR);
+		return;
+	}
+
+	if(adc_sink == ADC_SINK_SUM)
+	{
+		sample = ((ADCDATAH & 0x0F) << 8) | ADCDATAL;
+
+#if ADC_OVERSAMPLE_BITS > 0
+		// Decimate, the divide by 4^n and multiply by 2^n is a single shift, rounded so the
+		// result is not biased half an LSB low. The filters below run once per result.
+		adc_block += sample;
+		if(++adc_block_count != ADC_OVERSAMPLE_COUNT)
+		{
+			PROF_EXIT_EVERY(PROF_ADC_ISR);
+			return;
+		}
+		sample = (adc_block + (1 << ADC_OVERSAMPLE_BITS >> 1)) >> ADC_OVERSAMPLE_BITS;
+		adc_block = 0;
+		adc_block_count = 0;
+#endif
+
+		if(adc_filter_reset)
+		{
+			adc_filter_reset = 0;
+			adc_med_a = sample;
+			adc_med_b = sample;
+		}
+
+		if(adc_median)
+		{
+			// Median of the last 3 results, clamp this one between the other two
+			if(adc_med_a > adc_med_b)
+			{
+				magnitude = sample > adc_med_a ? adc_med_a : (sample < adc_med_b ? adc_med_b : sample);
+			}
+			else
+			{
+				magnitude = sample > adc_med_b ? adc_med_b : (sample < adc_med_a ? adc_med_a : sample);
+			}
+			adc_med_a = adc_med_b;
+			adc_med_b = sample;
+			sample = magnitude;
+		}
+
+		if(adc_filter == ADC_FILTER_IIR)
+		{
+			if(adc_iir == 0)
+			{
+				adc_iir = (uint32) sample << ADC_IIR_SHIFT;	// start from the first result
+			}
+			adc_iir = adc_iir - (adc_iir >> ADC_IIR_SHIFT) + sample;
+			sample = adc_iir >> ADC_IIR_SHIFT;
+		}
+		else if(adc_filter == ADC_FILTER_MOVING)
+		{
+			// Add the newest result and drop the oldest, the ring starts out as zeros
+			adc_ma_sum += sample;
+			adc_ma_sum -= adc_ma_ring[adc_ma_index];
+			adc_ma_ring[adc_ma_index] = sample;
+			adc_ma_index = (adc_ma_index + 1) & ADC_MA_MASK;
+			sample = adc_ma_sum >> ADC_MA_BITS;
+		}
+
+		adc_filtered = sample;
+		adc_sum += sample;
+		adc_sum_count++;
+		PROF_EXIT_EVERY(PROF_ADC_ISR);
+		return;
+	}
+
+	next = (adc_head + 1) & ADC_BUF_MASK;
+	if(next == adc_tail)
+	{
+		adc_overruns++;		// buffer full, drop the sample
+	}
+	else
+	{
+		adc_buf[adc_head] = ((ADCDATAH & 0x0F) << 8) | ADCDATAL;
+		adc_head = next;
+	}
+	// ADCI is cleared by hardware when vectoring to this ISR
+	PROF_EXIT_EVERY(PROF_ADC_ISR);
+}
+
+
+// Averages single conversions of a channel, only used while the engine is stopped
+static uint16 read_single(uint8 channel)
+{
+	uint16 sum = 0;
+	uint8 i;
+
+	ADCCON2 = channel;
+	for(i = 0; i < ADC_CAL_SAMPLES; i++)
+	{
+		ADCCON2 |= 0x10; // Trigger single conversion (Sets SCONV, Bit 4)
+		while((ADCCON2 & 0x10) == 0x10);
+		sum += ((ADCDATAH & 0x0F) << 8) | ADCDATAL;
+	}
+
+	return sum / ADC_CAL_SAMPLES;
+}
+
 
 // Calibrates ADC
 void adc_calibrate()
 {
+	uint16 full;
+
 	ADCCON2 = 0x0B; // select internal AGND
 	ADCCON3 = 0x25; // select offset calibration
 	while((ADCCON3 & 0x01) == 0x01); // Wait until calibration is done
@@ -17,40 +316,403 @@ void adc_calibrate()
 	ADCCON3 = 0x27; // select offset calibration,
 	while((ADCCON3 & 0x01) == 0x01); // Wait until calibration is done
 	adc.gain = ((ADCGAINH & 0x3F) << 8) | ADCGAINL;
+
+	// Measure what the hardware calibration leaves, AGND should read 0 and VREF full scale.
+	// The divide is done once here so every conversion is one multiply and a shift.
+	adc.zero = read_single(0x0B);
+	full = read_single(0x0C);
+	if(adc.zero >= full)
+	{
+		// Not a believable reading, and the span below would be 0 or wrap
+		adc.zero = 0;
+		adc.scale = ADC_SCALE_NOMINAL;
+		return;
+	}
+
+	// VREF is one count above the top code, so a part with no gain error reads it as the
+	// saturated 4095 and so does one that reads high. Only a gain that reads low shows up,
+	// a saturated reading says nothing and leaves the nominal scale, the hardware gain
+	// calibration above is what corrects the other direction.
+	if(full >= ADC_COUNTS - 1)
+	{
+		adc.scale = ADC_SCALE_NOMINAL;
+		return;
+	}
+	adc.scale = ((uint32) ADC_VREF_MV << 16) / (full - adc.zero);	// the reference spans these counts
+
+	if(adc.scale < ADC_SCALE_MIN || adc.scale > ADC_SCALE_MAX)
+	{
+		// Outside what the part can be off by, fall back to the nominal conversion
+		adc.zero = 0;
+		adc.scale = ADC_SCALE_NOMINAL;
+	}
+}
+
+
+// Converts a reading to mV with the calibrated zero and scale, rounded to the nearest mV
+uint16 adc_to_mV(uint16 raw)
+{
+	if(raw <= adc.zero)
+	{
+		return 0;
+	}
+	return ((uint32) (raw - adc.zero) * adc.scale + 0x8000) >> 16;
+}
+
+
+// Converts an oversampled result to mV, the zero and the shift are scaled up by the extra bits
+uint16 adc_oversampled_to_mV(uint16 value)
+{
+	uint16 zero = adc.zero << ADC_OVERSAMPLE_BITS;
+
+	if(value <= zero)
+	{
+		return 0;
+	}
+	return ((uint32) (value - zero) * adc.scale + (0x8000L << ADC_OVERSAMPLE_BITS)) >> (16 + ADC_OVERSAMPLE_BITS);
+}
+
+
+// Converts a difference between two readings to mV, the zero cancels out
+uint32 adc_span_to_mV(uint16 counts)
+{
+	return ((uint32) counts * adc.scale + 0x8000) >> 16;
 }
 
 
 void adc_setup()
 {
+	// Use the on-chip 2kB XRAM for the xdata ring buffer
+	CFG841 |= 0x01;
+
 	//MD1 		= 1, 	power up the ADC
 	//EXT_REF = 0, 	use internal reference
 	//CK      = 11, ADC clk = master clk/2 ~5.5MHz
 	//AQ      = 11, acqusistion of 4 ADC clks
 	//T2C			= 0,  Not using timer 2 to start converstion
 	//EXC			= 0,  Not using external trigger to start converstion
-  	ADCCON1 = 0xBC;
+  	ADCCON1 = ADC_CON1;
 	//adc converstion time of, 5.5MHz/(16+4) = 275KHz
 	adc_calibrate();
+
+	adc_head = 0;
+	adc_tail = 0;
+	adc_overruns = 0;
+	adc_channel = ADC_NO_CHANNEL;
+	adc_sink = ADC_SINK_RING;
+	adc_window_open = 0;
+	adc_ref = 2048;			// mid scale until a mean is known
+	adc_scan_count = 0;
+	adc_scan_seen = 0;
+	adc_set_filter(ADC_FILTER_NONE, 0);
+	ADCCON2 = 0x00;	// calibration leaves a channel selected, clear it
+}
+
+
+// Selects the filters of ADC_SINK_SUM and starts them again from the next conversion
+void adc_set_filter(uint8 filter, bit median)
+{
+	bit running = EADC;
+	uint16 i;
+
+	EADC = 0;
+	adc_filter = filter;
+	adc_median = median;
+	adc_filter_reset = 1;
+	adc_filtered = 0;
+	adc_iir = 0;
+	adc_ma_sum = 0;
+	adc_ma_index = 0;
+	for(i = 0; i < ADC_MA_SIZE; i++)
+	{
+		adc_ma_ring[i] = 0;
+	}
+	EADC = running;
+}
+
+
+// 'f' steps through the filters, 'm' turns the median of 3 on and off
+void adc_command(char c)
+{
+	switch(c)
+	{
+		case 'f':
+			adc_set_filter((adc_filter + 1) % ADC_FILTERS, adc_median);
+			break;
+
+		case 'm':
+			adc_set_filter(adc_filter, !adc_median);
+			break;
+	}
+}
+
+
+// Starts continuous conversions on a channel, each result is stored by adc_isr in the sink.
+// Does nothing if the channel is already being converted so callers can use it every read.
+void adc_start(uint8 channel, uint8 sink)
+{
+	if(adc_channel == channel && adc_sink == sink)
+	{
+		return;
+	}
+
+	adc_stop();
+	adc_flush();
+	adc_sum = 0;
+	adc_sum_count = 0;
+#if ADC_OVERSAMPLE_BITS > 0
+	adc_block = 0;
+	adc_block_count = 0;
+#endif
+	adc_channel = channel;
+	adc_sink = sink;
+	adc_set_filter(adc_filter, adc_median);
+	if(sink == ADC_SINK_SUM || sink == ADC_SINK_SQUARES)
+	{
+		ADCCON1 = ADC_CON1_SLOW;	// adc_stop() puts the full rate back
+	}
+	else if(sink == ADC_SINK_PEAK)
+	{
+		ADCCON1 = ADC_CON1_PEAK;
+	}
+
+	EADC = 1;						// enable adc interrupt
+	ADCCON2 = 0x20 | channel;		// set CCONV (Bit 5) and select the channel
+}
+
+
+// Starts continuous conversions that round-robin over a list of channels. adc_isr filters
+// each result into adc_scan_table, so any mode can read a channel with adc_scan_read().
+void adc_scan_start(const uint8 *channels, uint8 count)
+{
+	uint8 i;
+
+	adc_stop();
+	for(i = 0; i < count && i < ADC_SCAN_MAX; i++)
+	{
+		adc_scan_list[i] = channels[i];
+	}
+	adc_scan_count = i;
+	adc_scan_index = 0;
+	adc_scan_seen = 0;
+	if(adc_scan_count == 0)
+	{
+		return;
+	}
+
+	adc_channel = adc_scan_list[0];
+	adc_sink = ADC_SINK_SCAN;
+	ADCCON1 = ADC_CON1_SLOW;				// thousands of results a channel, adc_stop() restores
+
+	EADC = 1;								// enable adc interrupt
+	ADCCON2 = 0x20 | adc_scan_list[0];		// set CCONV (Bit 5) and select the first channel
+}
+
+
+// Starts converting a channel into the ring. The trigger is armed once pre_trigger samples
+// are in, and fires on the first sample that crosses level in the direction of edge.
+void adc_capture_start(uint16 xdata *ring, uint8 channel, uint16 level, uint8 edge, uint16 pre_trigger)
+{
+	adc_stop();
+
+	if(pre_trigger >= ADC_CAPTURE_SIZE)
+	{
+		pre_trigger = ADC_CAPTURE_SIZE - 1;
+	}
+	adc_capture_ring  = ring;
+	adc_capture_index = 0;
+	adc_capture_pre   = pre_trigger;
+	adc_capture_fill  = pre_trigger;
+	adc_capture_left  = 0;
+	adc_capture_level = level;
+	adc_capture_edge  = edge;
+	adc_capture_side  = edge;		// so a signal already past the level does not trigger at once
+	adc_capture_forced = 0;
+	adc_capture_ready  = 0;
+
+	adc_channel = channel;
+	adc_sink = ADC_SINK_CAPTURE;
+
+	EADC = 1;						// enable adc interrupt
+	ADCCON2 = 0x20 | channel;		// set CCONV (Bit 5) and select the channel
+}
+
+
+void adc_capture_force()
+{
+	adc_capture_forced = 1;
+}
+
+
+bit adc_capture_done()
+{
+	return adc_capture_ready;
 }
 
 
+// The ring is full once done, so the oldest sample is where the next would have gone
+uint16 adc_capture_first()
+{
+	return adc_capture_index;
+}
+
+
+// Latest filtered result of a scanned channel in counts, rounded
+uint16 adc_scan_read(uint8 channel)
+{
+	bit running = EADC;
+	uint16 value = 0;
+
+	if(channel >= ADC_SCAN_CHANNELS)
+	{
+		return 0;
+	}
+
+	EADC = 0;						// 2 bytes written by adc_isr
+	if(adc_scan_seen & (1 << channel))
+	{
+		value = (adc_scan_table[channel] + (1 << (ADC_SCAN_FRAC_BITS - 1))) >> ADC_SCAN_FRAC_BITS;
+	}
+	EADC = running;
+
+	return value;
+}
+
+
+// Latest filtered result of a scanned channel in mV
+uint16 adc_scan_mV(uint8 channel)
+{
+	return adc_to_mV(adc_scan_read(channel));
+}
+
+
+// Selects a channel without starting conversions, each one is then started by the trigger
+// in ADCCON1, such as ADC_CON1_T2C, and its result goes to the sink
+void adc_triggered_start(uint8 channel, uint8 sink)
+{
+	adc_stop();
+	adc_flush();
+	adc_channel = channel;
+	adc_sink = sink;
+
+	EADC = 1;						// enable adc interrupt
+	ADCCON2 = channel;				// CCONV and SCONV clear, only the trigger converts
+}
+
+
+void adc_stop()
+{
+	ADCCON1 = ADC_CON1;		// no conversions from timer 2
+	ADCCON2 = 0x00;			// clear CCONV, no more conversions
+	EADC = 0;				// disable adc interrupt
+	adc_channel = ADC_NO_CHANNEL;
+}
+
+
+void adc_flush()
+{
+	adc_tail = adc_head;
+}
+
+
+uint8 adc_available()
+{
+	return (adc_head - adc_tail) & ADC_BUF_MASK;
+}
+
+
+uint16 adc_read()
+{
+	uint16 value;
+
+	while(adc_head == adc_tail) HAL_IDLE(); // Wait for the ISR to push a sample
+
+	value = adc_buf[adc_tail];
+	adc_tail = (adc_tail + 1) & ADC_BUF_MASK;
+
+	return value;
+}
+
+
+// Averages the next num_samples conversions of the running channel, see adc_start() with ADC_SINK_RING
 uint16 get_adc_value(uint8 num_samples)
 {
 	uint32 avg = 0;
 	uint8 i = 0;
 
+	PROF_ENTER(PROF_ADC_VALUE);
 	for(i = 0; i < num_samples; i++)
 	{
-		ADCCON2 |= 0x10; // Trigger single conversion (Sets SCONV, Bit 4)
-
-		// Wait for ADCI flag (Bit 7) to become 1, meaning conversion is done
-		while((ADCCON2 & 0x10) == 0x10);
-		// ADCCON2 &= ~0x80; // Manually clear the ADCI flag
-
-		// Read the 12-bit value raw from the ADC data registers
-		avg  += ((ADCDATAH & 0x0F) << 8) | ADCDATAL;
+		avg += adc_read();
 	}
 	avg /= num_samples; //mean the value
+	PROF_EXIT(PROF_ADC_VALUE);
 
 	return (uint16) avg;
 }
+
+
+// Prepares a buffer for DMA capture. The ADC reads the channel of each conversion
+// from the top nibble of its slot and stops at a channel id of 0xF. Results are
+// written back with the same channel id, so a buffer only needs preparing once.
+void adc_dma_setup(uint16 xdata *buffer, uint16 num_samples, uint8 channel)
+{
+	uint16 i;
+
+	for(i = 0; i < num_samples; i++)
+	{
+		buffer[i] = (uint16) channel << 12;
+	}
+	buffer[num_samples] = 0xF000; // stop command
+}
+
+
+// Starts capturing one block at the full conversion rate, poll adc_dma_done() for the end
+void adc_dma_start(uint16 xdata *buffer)
+{
+	uint16 address = HAL_XDATA_ADDRESS(buffer);
+
+	// The ring buffer ISR must not see the end of DMA interrupt
+	adc_stop();
+
+	// Point the DMA at the start of the buffer
+	DMAL = address & 0xFF;
+	DMAH = address >> 8;
+	DMAP = 0x00;
+
+	ADCCON2 = 0x40;				// set DMA (Bit 6)
+	ADCCON2 = 0x60;				// set CCONV (Bit 5), conversions run until the stop command
+}
+
+
+// Returns 1 once the block started by adc_dma_start() is written
+bit adc_dma_done()
+{
+	if((ADCCON2 & 0x80) == 0)	// ADCI (Bit 7) is set once the whole block is written
+	{
+		return 0;
+	}
+
+	ADCCON2 = 0x00;				// leave DMA mode, clears ADCI
+	return 1;
+}
+
+
+// Updates min and max with every sample of a block, written as a tight loop over xdata
+void adc_block_minmax(uint16 xdata *buffer, uint16 num_samples, uint16 *min, uint16 *max)
+{
+	uint16 lo = *min;
+	uint16 hi = *max;
+	uint16 value;
+	uint16 xdata *end = buffer + num_samples;
+
+	while(buffer != end)
+	{
+		value = *buffer++ & 0x0FFF; // strip the channel id
+		if(value > hi) hi = value;
+		if(value < lo) lo = value;
+	}
+
+	*min = lo;
+	*max = hi;
+}
@@ -2,23 +2,160 @@
 #define ADC_MODE_H
 
 #include "typedef.h"
-#include <ADUC841.H>
+#include "hal.h"
+#include "config.h"
 
-#define ADC_AVG 5 //number of adc values to average together
+// Ring buffer filled by the adc interrupt, size must be a power of 2
+#define ADC_BUF_SIZE 	128
+#define ADC_BUF_MASK 	(ADC_BUF_SIZE - 1)
+#define ADC_NO_CHANNEL 	0xFF // adc_channel value when conversions are stopped
 
-//struct to store adc values
-// if we are not using calibration values this is useless
+// Where adc_isr puts each conversion
+#define ADC_SINK_RING	0	// push into the ring buffer
+#define ADC_SINK_SUM	1	// oversample and add to adc_sum and adc_sum_count
+#define ADC_SINK_SQUARES 2	// while adc_window_open, sum deviations from adc_ref and their squares
+#define ADC_SINK_SCAN	3	// filter into adc_scan_table by the channel id, then move to the next channel
+#define ADC_SINK_CAPTURE 4	// write an xdata ring until the trigger and the samples after it are in
+#define ADC_SINK_PEAK	5	// while adc_window_open, track the lowest and highest conversion
+
+// Triggered capture, the ring is a power of 2 so it is indexed with a mask
+#define ADC_CAPTURE_SIZE	256
+#define ADC_CAPTURE_MASK	(ADC_CAPTURE_SIZE - 1)
+#define ADC_EDGE_FALLING	0
+#define ADC_EDGE_RISING		1
+
+// Channel scanning, the ISR files each result by the channel id the ADC returns with it
+// so the table is right even when a conversion was started before the channel changed
+#define ADC_TEMP_CHANNEL	0x08	// on-chip temperature sensor
+#define ADC_SCAN_CHANNELS	9		// table slots, channels 0-7 and the temperature sensor
+#define ADC_SCAN_MAX		9		// longest scan list
+#define ADC_SCAN_FRAC_BITS	3		// table entries are 12.3 fixed point, fits an int16
+#ifndef ADC_SCAN_FILTER_SHIFT
+#define ADC_SCAN_FILTER_SHIFT	4	// IIR filter, each result moves the entry 1/16 of the way
+#endif
+
+// Oversampling in ADC_SINK_SUM, 4^n conversions are summed and shifted right by n
+// to give one 12+n bit result. ADC_OVERSAMPLE_BITS is set in config.h.
+#define ADC_OVERSAMPLE_COUNT	(1 << (2 * ADC_OVERSAMPLE_BITS))
+
+// Filters on the ADC_SINK_SUM path, all shifts and adds. They run once per oversampled
+// result rather than per conversion, so adc_isr only pays for them every
+// ADC_OVERSAMPLE_COUNT conversions. The median of 3 drops a single bad result, the IIR or
+// moving average then smooths what it passes.
+#define ADC_FILTER_NONE		0	// results go straight to adc_sum
+#define ADC_FILTER_IIR		1	// single pole, y += (x - y) / 2^ADC_IIR_SHIFT
+#define ADC_FILTER_MOVING	2	// mean of the last 2^ADC_MA_BITS results, O(1) per result
+#define ADC_FILTERS			3
+
+#ifndef ADC_IIR_SHIFT
+#define ADC_IIR_SHIFT	8		// time constant of 256 results, ~0.24 s at ADC_CON1_SLOW
+#endif
+#ifndef ADC_MA_BITS
+#define ADC_MA_BITS		6		// 64 results, ~60 ms, 2^(ADC_MA_BITS+1) bytes of the 2 kB xdata
+#endif
+#define ADC_MA_SIZE		(1 << ADC_MA_BITS)
+#define ADC_MA_MASK		(ADC_MA_SIZE - 1)
+
+#if ADC_IIR_SHIFT > 16 || ADC_MA_BITS > 8
+#error "ADC_IIR_SHIFT and ADC_MA_BITS must keep the filter sums within 32 bits"
+#endif
+
+// ADCCON1 as adc_setup() leaves it, and the bit that starts a conversion on each timer 2
+// overflow. A conversion takes ADC_CONVERSION_CYCLES core cycles with this setting.
+#define ADC_CON1				0xBC
+#define ADC_CON1_T2C			0x02
+#define ADC_CONVERSION_CYCLES	40
+
+// ADCCON1 for ADC_SINK_SUM, ADC_SINK_SQUARES and ADC_SINK_SCAN, the ADC clock at master
+// clk/32 gives a conversion every ADC_SLOW_CYCLES. On the target the ISR entry, the sink
+// dispatch and the exit alone are ~40 core cycles, the whole full rate. Per conversion the
+// SUM path then takes ~80, its filters ~250 once in ADC_OVERSAMPLE_COUNT, SQUARES ~200 with
+// its 16 by 16 bit square and SCAN ~120 with the filter step and the channel change. At 640 a conversion, ~17 kSPS, that is under a third of the core and
+// the timer 0 tick always gets in between two conversions.
+#define ADC_CON1_SLOW			0x8C
+#define ADC_SLOW_CYCLES			640
+
+// ADCCON1 for ADC_SINK_PEAK, master clk/8 for a conversion every ADC_PEAK_CYCLES. The peak
+// detector is ~70 core cycles a conversion with the ISR entry and exit, so at ~69 kSPS it
+// takes under half the core and the timer 0 tick gets in between, and a 2 kHz period still
+// has over 30 conversions. Faster inputs are sampled in equivalent time.
+#define ADC_CON1_PEAK			0xAC
+#define ADC_PEAK_CYCLES			160
+
+// Conversion to mV, the scale is mV per count in Q16 fixed point
+#define ADC_COUNTS			4096
+#define ADC_VREF_MV			VREF_MV
+#define ADC_SCALE_NOMINAL	(ADC_VREF_MV * 65536L / ADC_COUNTS)	// 40000 with the 2.5 V reference
+#define ADC_SCALE_MIN		(ADC_SCALE_NOMINAL * 49 / 50)		// calibration outside +-2% of nominal is ignored
+#define ADC_SCALE_MAX		(ADC_SCALE_NOMINAL * 51 / 50)
+#define ADC_CAL_SAMPLES		16		// conversions averaged for each calibration point
+
+//struct to store adc calibration values
+// offset and gain are applied by the ADC itself, zero and scale correct what is left over.
+// VREF reads as the saturated top code unless the gain reads low, so scale only corrects that
+// direction, see adc_calibrate().
 typedef struct {
-	uint32 value;
-	uint32 mV;
-	uint16 offset;
-	uint16 gain;
+	uint16 offset;	// ADCOFS after hardware offset calibration
+	uint16 gain;	// ADCGAIN after hardware gain calibration
+	uint16 zero;	// counts read from AGND after calibration
+	uint16 scale;	// mV per count in Q16, from the AGND and VREF readings
 } ADC;
 
+extern ADC xdata adc;
+
+extern uint16 idata adc_overruns; // number of samples dropped because the ring buffer was full
+extern uint32 idata adc_sum;		// running sum of oversampled results in ADC_SINK_SUM
+extern uint32 idata adc_sum_count; // number of oversampled results in adc_sum
+extern uint16 xdata adc_filtered;	// latest filter output in ADC_SINK_SUM, 12+ADC_OVERSAMPLE_BITS bits
+extern uint8  xdata adc_filter;	// ADC_FILTER_ in use
+extern bit    adc_median;	// median of 3 spike rejection in use
+
+// ADC_SINK_SQUARES and ADC_SINK_PEAK window, opened and closed from the schmitt edge interrupt.
+// Deviations from adc_ref keep the squares small and the variance exact.
+extern bit    adc_window_open;	// conversions are only accumulated while set
+extern bit    adc_window_reset;	// set with adc_window_open to clear the sums on the next conversion
+extern uint16 idata adc_ref;			// reference the deviations are taken from, best near the mean
+extern int32  idata adc_dev_sum;		// sum of (sample - adc_ref)
+extern uint32 idata adc_sq_lo;		// sum of (sample - adc_ref)^2, low 32 bits
+extern uint16 idata adc_sq_hi;		// and the bits above them
+extern uint16 adc_peak_min;		// lowest and highest conversion in the window, ADC_SINK_PEAK
+extern uint16 adc_peak_max;
+
+extern uint16 xdata adc_scan_table[ADC_SCAN_CHANNELS]; // filtered result of each channel, 12.3 fixed point
+extern uint16 idata adc_scan_seen;	// bit n set once channel n has a result
 
 //functions
 void adc_calibrate(); //calibrates the adc, gets offset and gain error
 void adc_setup();			//sets up adc
+void adc_start(uint8 channel, uint8 sink); // starts continuous conversions on a channel into a sink
+void adc_triggered_start(uint8 channel, uint8 sink); // converts a channel on each trigger set in ADCCON1
+void adc_stop();			//stops continuous or triggered conversions
+void adc_flush();			//discards all samples waiting in the ring buffer
+uint8 adc_available();		//number of samples waiting in the ring buffer
+uint16 adc_read();			//takes the oldest sample from the ring buffer, waits if empty
 uint16 get_adc_value(uint8 num_samples); //gets raw adc value
+uint16 adc_to_mV(uint16 raw);	//calibrated conversion of a reading to mV
+uint16 adc_oversampled_to_mV(uint16 value); //same for a 12+ADC_OVERSAMPLE_BITS bit result
+void adc_set_filter(uint8 filter, bit median); //selects the ADC_SINK_SUM filters and restarts them
+void adc_command(char c);	//'f' steps through the filters, 'm' toggles the median
+uint32 adc_span_to_mV(uint16 counts); //calibrated conversion of a difference of readings to mV
+
+// Triggered capture at the full conversion rate into a ring of ADC_CAPTURE_SIZE samples.
+// Once done the oldest sample is at adc_capture_first() and the trigger pre_trigger after it.
+void adc_capture_start(uint16 xdata *ring, uint8 channel, uint16 level, uint8 edge, uint16 pre_trigger);
+void adc_capture_force();	//triggers on the next conversion, for when no edge comes
+bit adc_capture_done();		//returns 1 once the ring holds the samples around the trigger
+uint16 adc_capture_first();	//ring index of the oldest sample
+
+// Channel scanning, the table can be read at any time without waiting for a conversion
+void adc_scan_start(const uint8 *channels, uint8 count); //round-robins continuous conversions over a list
+uint16 adc_scan_read(uint8 channel);	//latest filtered result of a channel in counts, 0 if none yet
+uint16 adc_scan_mV(uint8 channel);		//same, converted to mV
+
+// DMA block capture, the buffer must hold num_samples + 1 words
+void adc_dma_setup(uint16 xdata *buffer, uint16 num_samples, uint8 channel); //preloads channel ids and stop marker
+void adc_dma_start(uint16 xdata *buffer); //starts filling a prepared buffer over DMA
+bit adc_dma_done();			//returns 1 once the DMA block is complete
+void adc_block_minmax(uint16 xdata *buffer, uint16 num_samples, uint16 *min, uint16 *max); //widens min/max over a block
 
 #endif
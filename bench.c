@@ -0,0 +1,386 @@
+#include "hal.h"
+#include "typedef.h"
+#include "bench.h"
+#include "uart.h"
+#include "display.h"
+#include "measurements.h"
+#include "adc_interactions.h"
+
+#ifdef BENCH
+
+uint8  xdata bench_latency_min;
+uint8 xdata bench_latency_max;
+uint32 xdata bench_latency_sum;
+uint32 xdata bench_latency_count;
+
+uint16 xdata bench_block[BENCH_BLOCK + 1];	// DMA buffer, plus stop command
+uint32 xdata bench_result;	// results are kept here so the calls cannot be left out
+uint8 code bench_scan[] = {DC_CHANNEL, AMP_CHANNEL};	// channels of the scan sink row
+uint8 code bench_numbers[10] = {NUM_0, NUM_1, NUM_2, NUM_3, NUM_4, NUM_5, NUM_6, NUM_7, NUM_8, NUM_9};
+
+// Statistics of the routine being timed
+static uint32 xdata start;
+static uint32 xdata overhead;	// cycles bench_begin() and bench_end() add on their own
+static uint32 xdata total;
+static uint32 xdata best;
+static uint32 xdata worst;
+static uint32 xdata calls;
+
+
+// 32-bit cycle count from timer 1 and its overflows, same fix-up as the timer 2 ISR
+static uint32 bench_now()
+{
+	uint8  high, low;
+	uint16 overflows;
+
+	ET1 = 0;
+	high = TH1;
+	low  = TL1;
+	if(high != TH1)		// TL1 rolled over between the reads, read again
+	{
+		high = TH1;
+		low  = TL1;
+	}
+	overflows = timer1_overflows;
+	if(TF1 && !(high & 0x80))	// timer 1 overflowed but its ISR has not run yet
+	{
+		overflows++;
+	}
+	ET1 = 1;
+
+	return ((uint32) overflows << 16) | ((uint16) high << 8) | low;
+}
+
+
+static void bench_reset()
+{
+	total = 0;
+	best  = 0xFFFFFFFFL;
+	worst = 0;
+	calls = 0;
+}
+
+
+static void bench_begin()
+{
+	start = bench_now();
+}
+
+
+static void bench_end()
+{
+	uint32 cycles = bench_now() - start;
+
+	cycles = cycles > overhead ? cycles - overhead : 0;
+	total += cycles;
+	if(cycles < best)  best = cycles;
+	if(cycles > worst) worst = cycles;
+	calls++;
+}
+
+
+// Prints routine,calls,mean,min,max,samples_per_s with the time columns in BENCH_UNITS
+static void bench_report(const char *name, uint16 samples)
+{
+	uart_puts(name);
+	uart_putc(',');
+	uart_put_uint(calls);
+	uart_putc(',');
+	uart_put_uint((total + calls / 2) / calls);
+	uart_putc(',');
+	uart_put_uint(best);
+	uart_putc(',');
+	uart_put_uint(worst);
+	uart_putc(',');
+	if(samples != 0 && total >= 16)
+	{
+		// Scaled by 16 on both sides so samples * clock fits 32 bits
+		uart_put_uint((uint32) samples * calls * (TIMER_CLOCK / 16) / (total / 16));
+	}
+	uart_puts("\r\n");
+}
+
+
+// One single conversion of the DC channel, with or without the ADC interrupt taking it.
+// The ISR runs as the conversion ends, before the wait below can see SCONV clear and
+// leave. Clearing ADCCON2 afterwards stops the next conversion the scan sink starts.
+static void bench_conversion(bit isr)
+{
+	EADC = isr;
+	bench_begin();
+	ADCCON2 = 0x10 | DC_CHANNEL;	// SCONV
+	while(ADCCON2 & 0x10);
+	ADCCON2 = 0x00;
+	bench_end();
+	EADC = 0;
+}
+
+
+// Times adc_isr on single conversions into the sink a start function has just set up.
+// The conversions are stopped again first, only the ones started here reach the ISR.
+static void bench_adc_isr(const char *name)
+{
+	uint8 i;
+
+	adc_stop();
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_conversion(1);
+	}
+	bench_report(name, 0);
+}
+
+
+// write_number() the way display() used to find the digits, with % and /. Only here for the
+// write_number_divide row, against the subtraction of powers of ten in display.c.
+static void bench_write_number_divide(uint32 value, uint8 dot_position)
+{
+	uint8 i, segment;
+	uint8 digit[5];
+	uint8 first = (dot_position == NO_DOT) ? 0 : dot_position;
+	bit leading = 1;
+
+	if(value > NUMBER_MAX)
+	{
+		value = NUMBER_MAX;
+	}
+	for(i = 0; i < 5; i++)
+	{
+		digit[i] = value % 10;
+		value /= 10;
+	}
+
+	for(i = 5; i > 0; i--)
+	{
+		if(digit[i - 1] != 0 || i - 1 <= first)
+		{
+			leading = 0;
+		}
+		segment = leading ? 0x00 : bench_numbers[digit[i - 1]];
+		if(dot_position == i - 1)
+		{
+			segment |= NUM_dot;
+		}
+		write_digit(DIG_3 + i - 1, segment);
+	}
+}
+
+
+// Waits for the next two scheduler ticks, so queued display writes have gone out
+static void bench_settle()
+{
+	uint8 i;
+
+	for(i = 0; i < 2; i++)
+	{
+		while(!scheduler_tick()) HAL_IDLE();
+	}
+}
+
+
+void bench_run()
+{
+	uint8 i;
+	uint16 min, max;
+	uint32 saved;
+
+	// xdata is not cleared at reset, the latency is taken from here on
+	EA = 0;
+	bench_latency_min   = 0xFF;
+	bench_latency_max   = 0;
+	bench_latency_sum   = 0;
+	bench_latency_count = 0;
+	EA = 1;
+
+	uart_puts("routine,calls,mean_" BENCH_UNITS ",min_" BENCH_UNITS ",max_" BENCH_UNITS ",samples_per_s\r\n");
+
+	// The cost of the timing itself, taken off every other row
+	overhead = 0;
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_begin();
+		bench_end();
+	}
+	overhead = best;
+	bench_report("bench_overhead", 0);
+
+	// One register write into the SPI queue
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_settle();
+		bench_begin();
+		write_spi(INT_REG, 0x0A);
+		bench_end();
+	}
+	bench_report("write_spi", 0);
+
+	// Every digit of the number changes, then nothing changes
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_settle();
+		bench_begin();
+		display((i & 1) ? 11111 : 22222, DC_MODE);
+		bench_end();
+	}
+	bench_report("display_changed", 0);
+
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_begin();
+		display(22222, DC_MODE);
+		bench_end();
+	}
+	bench_report("display_unchanged", 0);
+
+	// The digit extraction alone, by subtraction and by division, on the same numbers with
+	// all five digits changing. 99999 is the most subtractions, 45. In the simulator the two
+	// rows only differ by the SFR accesses, the comparison is one of target tables.
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_settle();
+		bench_begin();
+		write_number((i & 1) ? 99999 : 12345, NO_DOT);
+		bench_end();
+	}
+	bench_report("write_number", 0);
+
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_settle();
+		bench_begin();
+		bench_write_number_divide((i & 1) ? 99999 : 12345, NO_DOT);
+		bench_end();
+	}
+	bench_report("write_number_divide", 0);
+
+	// Averaging through the ring buffer at the full conversion rate
+	adc_start(DC_CHANNEL, ADC_SINK_RING);
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		adc_flush();
+		bench_begin();
+		bench_result = get_adc_value(16);
+		bench_end();
+	}
+	bench_report("get_adc_value_16", 16);
+	adc_stop();
+
+	// One DMA block as used by the amplitude mode, and the peak detector over it
+	adc_dma_setup(bench_block, BENCH_BLOCK, AMP_CHANNEL);
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_begin();
+		adc_dma_start(bench_block);
+		while(!adc_dma_done());
+		bench_end();
+	}
+	bench_report("adc_dma_block", BENCH_BLOCK);
+
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		min = 0xFFFF;
+		max = 0;
+		bench_begin();
+		adc_block_minmax(bench_block, BENCH_BLOCK, &min, &max);
+		bench_end();
+	}
+	bench_result = max - min;
+	bench_report("adc_block_minmax", BENCH_BLOCK);
+
+	// Conversions to mV
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_begin();
+		bench_result = adc_to_mV(1000 + i);
+		bench_end();
+	}
+	bench_report("adc_to_mV", 0);
+
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_begin();
+		bench_result = adc_oversampled_to_mV(4000 + i);
+		bench_end();
+	}
+	bench_report("adc_oversampled_to_mV", 0);
+
+	// adc_isr into each sink for one conversion. A conversion without the interrupt is
+	// taken off these rows as well, so they are the ISR with its entry and return. The
+	// SUM rows filter one conversion in ADC_OVERSAMPLE_COUNT, the max is that path.
+	adc_stop();
+	bench_reset();
+	for(i = 0; i < BENCH_RUNS; i++)
+	{
+		bench_conversion(0);
+	}
+	bench_report("adc_conversion", 0);
+	saved = overhead;
+	overhead += best;
+
+	adc_start(DC_CHANNEL, ADC_SINK_RING);
+	bench_adc_isr("adc_isr_ring");
+
+	adc_start(DC_CHANNEL, ADC_SINK_SUM);
+	bench_adc_isr("adc_isr_sum");
+	adc_set_filter(ADC_FILTER_NONE, 1);
+	adc_start(DC_CHANNEL, ADC_SINK_SUM);
+	bench_adc_isr("adc_isr_sum_median");
+	adc_set_filter(ADC_FILTER_IIR, 0);
+	adc_start(DC_CHANNEL, ADC_SINK_SUM);
+	bench_adc_isr("adc_isr_sum_iir");
+	adc_set_filter(ADC_FILTER_MOVING, 0);
+	adc_start(DC_CHANNEL, ADC_SINK_SUM);
+	bench_adc_isr("adc_isr_sum_moving");
+	adc_set_filter(ADC_FILTER_NONE, 0);
+
+	adc_start(DC_CHANNEL, ADC_SINK_SQUARES);
+	adc_window_reset = 1;
+	adc_window_open  = 1;
+	bench_adc_isr("adc_isr_squares");
+	adc_start(DC_CHANNEL, ADC_SINK_PEAK);
+	adc_window_reset = 1;
+	adc_window_open  = 1;
+	bench_adc_isr("adc_isr_peak");
+	adc_window_open  = 0;
+
+	adc_scan_start(bench_scan, sizeof(bench_scan));
+	bench_adc_isr("adc_isr_scan");
+
+	// Armed with a level no conversion reaches, the path of every sample before a trigger.
+	// BENCH_RUNS samples only use the start of the block as the ring.
+	adc_capture_start(bench_block, DC_CHANNEL, ADC_COUNTS, ADC_EDGE_RISING, 0);
+	bench_adc_isr("adc_isr_capture");
+	overhead = saved;
+
+	// Keep the ADC interrupt at its full rate for a while so the latency includes it
+	adc_start(DC_CHANNEL, ADC_SINK_SUM);
+	for(i = 0; i < BENCH_LOAD_TICKS; i++)
+	{
+		while(!scheduler_tick()) HAL_IDLE();
+	}
+	adc_stop();
+
+	EA = 0;
+	total = bench_latency_sum;
+	calls = bench_latency_count;
+	best  = bench_latency_min;
+	worst = bench_latency_max;
+	EA = 1;
+	bench_report("timer0_latency", 0);
+
+	while(1) HAL_IDLE();
+}
+
+#endif
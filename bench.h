@@ -0,0 +1,35 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "typedef.h"
+
+// Cycle counts of the measurement routines, built in when BENCH is defined on the compiler
+// command line. bench_run() times each routine with timer 1, prints a CSV table on the
+// UART and does not return. tools/bench_compare.py compares two tables.
+//
+// On the target add BENCH to the C51 defines of the uvproj and log the UART at 115200 8N1,
+// the rows are real core cycles. "make bench" runs the same code in the simulator.
+// No table has been taken on the target yet. The simulator only charges time for SFR
+// accesses, ISR entries and HAL_IDLE(), nothing for the code between them, so its table
+// is headed BENCH_UNITS "access_cycles" instead of "cycles". Those rows check the harness
+// and the peripheral bound routines, bench_compare.py reports them but never fails on them.
+
+#define BENCH_RUNS	16		// calls timed per routine
+#define BENCH_BLOCK	128		// samples per block in the DMA and peak detector rows
+#define BENCH_LOAD_TICKS	20	// scheduler ticks the ISR latency is also measured under full ADC load
+
+#ifdef __C51__
+#define BENCH_UNITS	"cycles"
+#else
+#define BENCH_UNITS	"access_cycles"
+#endif
+
+// Timer 0 interrupt latency, cycles from the overflow to the first statement of the ISR
+extern uint8  xdata bench_latency_min;
+extern uint8  xdata bench_latency_max;
+extern uint32 xdata bench_latency_sum;
+extern uint32 xdata bench_latency_count;
+
+void bench_run();
+
+#endif
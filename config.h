@@ -0,0 +1,103 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Build configuration. The clock, the gate, the reference and the oversampling are set here,
+// everything that depends on them is worked out by the preprocessor, so changing one is a
+// single define with nothing left to compute at run time. Each can be overridden on the
+// compiler command line: the C51 defines of the uvproj, or HOST_DEFINES for "make host".
+//
+//   make host HOST_DEFINES=-DGATE_MAX_STEP=0     // a fixed frequency gate of GATE_MS
+//
+// Only plain integer arithmetic is used, the values go into #if checks. Keil evaluates those
+// in 32 bits, so products are kept below 2^31. Periods are timed in 16 bit counts of timer 0
+// interrupts, so the 1 s ones of measurements.h only fit up to ~16 MHz.
+
+#ifndef F_OSC
+#define F_OSC				11059200L	// core clock, Hz
+#endif
+#ifndef GATE_MS
+#define GATE_MS				100			// shortest frequency mode gate
+#endif
+#ifndef GATE_MAX_MS
+#define GATE_MAX_MS			1000		// longest frequency mode gate, a reading at least every second
+#endif
+#ifndef GATE_EDGES
+#define GATE_EDGES			10000L		// edges a counted reading aims for, the 5 digits of the display
+#endif
+#ifndef VREF_MV
+#define VREF_MV				2500		// ADC reference
+#endif
+#ifndef ADC_OVERSAMPLE_BITS
+#define ADC_OVERSAMPLE_BITS	2			// 4^n conversions per 12+n bit result on the DC path
+#endif
+#ifndef TICK_MS
+#define TICK_MS				10			// scheduler tick
+#endif
+
+// Timer 0 interrupts every TIMER0_CYCLES core cycles, auto reloaded in mode 2
+#ifndef TIMER0_CYCLES
+#define TIMER0_CYCLES		250
+#endif
+#define TIMER0_RELOAD		(256 - TIMER0_CYCLES)
+
+// Core cycles and timer 0 interrupts in ms milliseconds, the interrupts rounded to the nearest
+#define MS_CYCLES(ms)		(F_OSC / 100 * (ms) / 10)
+#define MS_INTS(ms)			((MS_CYCLES(ms) + TIMER0_CYCLES / 2) / TIMER0_CYCLES)
+
+#define TICK_INTS			MS_INTS(TICK_MS)
+#define GATE_INTS			MS_INTS(GATE_MS)
+
+// The gate adapts from GATE_MS to GATE_MS << GATE_MAX_STEP, the most doublings that stay
+// within GATE_MAX_MS: 800 ms by default
+#ifndef GATE_MAX_STEP
+#if GATE_MS * 256L <= GATE_MAX_MS
+#define GATE_MAX_STEP		8
+#elif GATE_MS * 128L <= GATE_MAX_MS
+#define GATE_MAX_STEP		7
+#elif GATE_MS * 64L <= GATE_MAX_MS
+#define GATE_MAX_STEP		6
+#elif GATE_MS * 32L <= GATE_MAX_MS
+#define GATE_MAX_STEP		5
+#elif GATE_MS * 16L <= GATE_MAX_MS
+#define GATE_MAX_STEP		4
+#elif GATE_MS * 8L <= GATE_MAX_MS
+#define GATE_MAX_STEP		3
+#elif GATE_MS * 4L <= GATE_MAX_MS
+#define GATE_MAX_STEP		2
+#elif GATE_MS * 2L <= GATE_MAX_MS
+#define GATE_MAX_STEP		1
+#else
+#define GATE_MAX_STEP		0
+#endif
+#endif
+#define GATE_CYCLES			(GATE_INTS * (uint32) TIMER0_CYCLES)	// the shortest gate as it is timed
+
+#if F_OSC % 100 != 0 || F_OSC > 20000000L
+#error "F_OSC must be a multiple of 100 Hz, the ADuC841 runs up to 20 MHz"
+#endif
+#if TIMER0_CYCLES < 100 || TIMER0_CYCLES > 256
+#error "TIMER0_CYCLES must fit the 8 bit reload and leave time for the timer 0 ISR"
+#endif
+#if TICK_INTS < 1 || TICK_INTS > 65535
+#error "TICK_MS must be at least one timer 0 interrupt and fit the 16 bit tick counter"
+#endif
+#if GATE_MS < 2 || GATE_INTS > 65535
+#error "GATE_MS must be at least 2 ms and fit the 16 bit period counter"
+#endif
+#if GATE_MAX_STEP < 0 || GATE_MAX_STEP > 8
+#error "GATE_MAX_STEP must be 0 to 8, the gate is counted in 8 bit laps of GATE_MS"
+#endif
+#if GATE_EDGES < 100 || GATE_EDGES > 0x4000
+#error "GATE_EDGES must be 100 to 16384, a gate that overflows the 16 bit edge count is too long"
+#endif
+#if GATE_INTS * TIMER0_CYCLES > (0x7FFFFFFFL >> GATE_MAX_STEP)
+#error "the longest gate must fit 32 bits of core cycles"
+#endif
+#if VREF_MV < 1000 || VREF_MV > 4000
+#error "VREF_MV must keep the Q16 mV per count scale and its +-2% window within 16 bits"
+#endif
+#if ADC_OVERSAMPLE_BITS < 0 || ADC_OVERSAMPLE_BITS > 4
+#error "ADC_OVERSAMPLE_BITS must be 0 to 4, results are limited to 16 bits"
+#endif
+
+#endif
@@ -1,8 +1,50 @@
 #include "display.h"
 #include "typedef.h"
 #include "measurements.h"
+#include "profile.h"
 
-sbit  LOAD = 0xB2; // P3.2
+// Copy of what the 8 digit registers hold, so unchanged digits are not resent
+uint8 xdata digit_shadow[8];
+uint8 xdata shadow_valid; // bit n set once DIG_n holds digit_shadow[n]
+uint8 xdata unit_dots;	// bit n lights the dot of units digit DIG_n
+
+// Register writes waiting to be clocked out by spi_isr
+uint8 idata spi_queue_address[SPI_QUEUE_SIZE];
+uint8 idata spi_queue_data[SPI_QUEUE_SIZE];
+uint8 idata spi_head;	// next free slot, only moved by write_spi
+uint8 idata spi_tail;	// write being sent, only moved by spi_isr
+bit   spi_busy;		// a transfer is in progress
+bit   spi_data_sent;	// the byte just finished was the data byte
+
+// SPI interrupt, clocks out the address then the data of each queued write
+// and pulses LOAD between writes so the display latches them
+HAL_ISR(spi_isr, 7)
+{
+	ISPI = 0;
+
+	if(!spi_data_sent)
+	{
+		// Address done, send the data byte to indicate what to display on segment
+		spi_data_sent = 1;
+		SPIDAT = spi_queue_data[spi_tail];
+		return;
+	}
+
+	// Set load (P3.2) to 1, the display latches the 16 bits
+	LOAD = 1;
+	spi_tail = (spi_tail + 1) & SPI_QUEUE_MASK;
+
+	if(spi_tail == spi_head)
+	{
+		spi_busy = 0;	// queue empty
+		return;
+	}
+
+	// Start the next write
+	LOAD = 0;
+	spi_data_sent = 0;
+	SPIDAT = spi_queue_address[spi_tail];
+}
 
 void display_setup()
 {
@@ -23,6 +65,14 @@ void display_setup()
 		// Set load (P3.2) to 1 so is high from start instead of floating
 		LOAD = 1;
 
+		// Empty queue, SPI interrupt on
+		spi_head = 0;
+		spi_tail = 0;
+		spi_busy = 0;
+		unit_dots = 0;
+		IEIP2 |= 0x01;	// ESI, enable SPI interrupt
+		EA = 1;			// needed to drain the queue
+
     // Set no decode mode
     write_spi(DEC_REG, 0x00);
 
@@ -31,97 +81,319 @@ void display_setup()
 
     // Set digits 0 1 2 3 4 5 6 7 ON
     write_spi(SCAN_REG, 0x07);
+
+    // Leave shutdown mode, display() keeps the display on from here
+    write_spi(SHD_REG, 0x01);
+
+    // Digit registers are unknown after power up, the first display() writes them all
+    shadow_valid = 0x00;
 }
 
-// Writes 1 byte of info to a reg
+// Queues 1 byte of info for a reg and returns, spi_isr sends it.
+// Only waits if the queue is full.
 void write_spi(uint8 address, uint8 data_to_write)
 {
-	volatile uint8 i;
-  address = address & 0x0F; 	  // Get 4 address bits for
+	uint8 next = (spi_head + 1) & SPI_QUEUE_MASK;
 
-  // Set load (P3.0) to 0
-	LOAD = 0;
+	while(next == spi_tail) HAL_IDLE();	// Wait for spi_isr to make room
 
-  // First send address to select a segment
-  SPIDAT = address; 			  // Send address byte
-	while(!ISPI);     			  // Wait for ISPI to be 1 to indcate finished
-	for(i = 0; i < 10; i++); 	  // Small delay
-	ISPI=0;
+	spi_queue_address[spi_head] = address & 0x0F; 	// Get 4 address bits
+	spi_queue_data[spi_head] = data_to_write;
 
-	// Then send data byte to indicate what to display on segmemt
-  SPIDAT = data_to_write;   	  // Send data byte
-	while(!ISPI);     			  // Wait for ISPI to be 1 to indcate finished
-	for(i = 0; i < 10; i++); 	  // Small delay
-	ISPI = 0;
+	IEIP2 &= ~0x01;				// keep spi_isr out while checking if it is idle
+	spi_head = next;
+	if(!spi_busy)
+	{
+		// Set load (P3.2) to 0 and send address byte to select a segment,
+		// spi_isr takes over when it is done
+		spi_busy = 1;
+		spi_data_sent = 0;
+		LOAD = 0;
+		SPIDAT = spi_queue_address[spi_tail];
+	}
+	IEIP2 |= 0x01;
+}
 
-	// Set load (P3.0) to 1
-	LOAD = 1;
+// Writes a digit register, skipping the SPI transfer if it already holds the segments
+void write_digit(uint8 address, uint8 segment)
+{
+	uint8 index = address - DIG_0;
+	uint8 mask  = 1 << index;
+
+	if((shadow_valid & mask) && (digit_shadow[index] == segment))
+	{
+		return;
+	}
+
+	write_spi(address, segment);
+	digit_shadow[index] = segment;
+	shadow_valid |= mask;
 }
 
-// Writes the appropriate units to the display depending on the mode
-void write_mode_units(uint8 mode)
+// Segment patterns for 0-9 and powers of ten for extracting digits, kept in program memory
+uint8 code segments[10] = {NUM_0, NUM_1, NUM_2, NUM_3, NUM_4, NUM_5, NUM_6, NUM_7, NUM_8, NUM_9};
+uint32 code powers_of_ten[10] = {1, 10, 100, 1000, 10000, 100000, 1000000L, 10000000L, 100000000L, 1000000000L};
+
+// Writes a units digit, with its dot if display_marks() has set it
+static void write_unit(uint8 address, uint8 segment)
+{
+	if(unit_dots & (1 << (address - DIG_0)))
+	{
+		segment |= NUM_dot;
+	}
+	write_digit(address, segment);
+}
+
+// Sets the dots of the units digits, bit n is the dot of DIG_n. They mark the statistics
+// views, which show the same units as the live reading.
+void display_marks(uint8 dots)
+{
+	unit_dots = dots;
+}
+
+// Writes the appropriate units to the display depending on the mode and the prefix picked
+// by write_scaled(). m takes two digits so it is only used for mV, MHz gets a single digit M.
+void write_mode_units(uint8 mode, int8 prefix)
 {
 	switch(mode)
 	{
 		case DC_MODE:
-			write_spi(DIG_2, LETTER_M_1);
-			write_spi(DIG_1, LETTER_M_2);
-			write_spi(DIG_0, LETTER_V);
+			if(prefix == PREFIX_MILLI)
+			{
+				write_unit(DIG_2, LETTER_M_1);
+				write_unit(DIG_1, LETTER_M_2);
+			}
+			else
+			{
+				write_unit(DIG_2, 0x00);
+				write_unit(DIG_1, 0x00);
+			}
+			write_unit(DIG_0, LETTER_V);
 			break;
 
 		case FREQ_MODE:
-			write_spi(DIG_2, 0x00);
-			write_spi(DIG_1, LETTER_H);
-			write_spi(DIG_0, LETTER_Z);
+			if(prefix == PREFIX_MEGA)
+			{
+				write_unit(DIG_2, LETTER_BIG_M);
+			}
+			else if(prefix == PREFIX_KILO)
+			{
+				write_unit(DIG_2, LETTER_K);
+			}
+			else
+			{
+				write_unit(DIG_2, 0x00);
+			}
+			write_unit(DIG_1, LETTER_H);
+			write_unit(DIG_0, LETTER_Z);
 			break;
 
 		case AMP_MODE:
-			write_spi(DIG_2, LETTER_V);
-			write_spi(DIG_1, LETTER_P);
-			write_spi(DIG_0, LETTER_P);
+		case CAPTURE_MODE: // peak to peak of the trace
+			write_unit(DIG_2, LETTER_V);
+			write_unit(DIG_1, LETTER_P);
+			write_unit(DIG_0, LETTER_P);
+			break;
+
+		case RMS_MODE:
+			write_unit(DIG_2, LETTER_V);
+			write_unit(DIG_1, LETTER_A);
+			write_unit(DIG_0, LETTER_C);
+			break;
+
+		case SCAN_MODE: // mV of a channel, shown as C and the channel number
+			write_unit(DIG_2, LETTER_C);
+			write_unit(DIG_1, 0x00);
+			write_unit(DIG_0, segments[measurement_channel()]);
 			break;
 
 		default: // All switches off, or more than one switch on, display 0
-			write_spi(DIG_2, 0x00);
-			write_spi(DIG_1, 0x00);
-			write_spi(DIG_0, 0x00);
+			write_unit(DIG_2, 0x00);
+			write_unit(DIG_1, 0x00);
+			write_unit(DIG_0, 0x00);
 	}
 }
 
-// Displays the value on the 8 digit 7-segment display
-void display(uint16 value, uint8 mode)
+// Writes a 5 digit number to DIG_7..DIG_3 with a dot after digit dot_position (0 is the units).
+// Zeros in front of the first significant digit are blanked, except the one before the dot.
+// Digits are found by counting subtractions of each power of ten, the 8051 only divides 8 bits
+// so this is much cheaper than % 10 and / 10. Each digit takes at most 9 subtractions.
+void write_number(uint32 value, uint8 dot_position)
 {
 	uint8 i, digit, segment;
-	uint8 segments[11] = {NUM_0, NUM_1, NUM_2, NUM_3, NUM_4, NUM_5, NUM_6, NUM_7, NUM_8, NUM_9, NUM_dot};
+	uint8 first = (dot_position == NO_DOT) ? 0 : dot_position; // lowest digit that is never blanked
+	bit leading = 1;
+	uint32 power;
 
-	// Turn off the display so digits appear at once
-  	write_spi(SHD_REG, 0x01);
-
-	// Extract each digit from the value and write to the corresponding display segment
-	for(i = 3; i < 8; i++)
+	if(value > NUMBER_MAX)
 	{
-		// Extract the least significant digit
-		digit = value % 10;
-		value /= 10;
+		value = NUMBER_MAX;
+	}
 
-		// Get the segment pattern for the digit
-		segment = segments[digit];
+	// Most significant digit first, DIG_7 holds the ten thousands
+	for(i = 4; i > 0; i--)
+	{
+		power = powers_of_ten[i];
+		digit = 0;
+		while(value >= power)
+		{
+			value -= power;
+			digit++;
+		}
 
-		// Since Amp mode is in V add a dot
-		if((mode == AMP_MODE) && (i == 6))
+		if(digit != 0 || i <= first)
+		{
+			leading = 0;
+		}
+		segment = leading ? 0x00 : segments[digit];
+		if(dot_position == i)
 		{
 			segment |= NUM_dot;
 		}
-		//^ this is so anyyoinh I think we should do 2 loops, or figure a better way
+		write_digit(DIG_3 + i, segment);
+	}
 
-		// Write the segment pattern to the corresponding display segment
-		write_spi(i+1, segment);
+	// What is left is the units
+	segment = segments[value];
+	if(dot_position == 0)
+	{
+		segment |= NUM_dot;
 	}
+	write_digit(DIG_3, segment);
+}
 
-	// Write units to display depending on mode
-	write_mode_units(mode);
+uint8 number_digits(uint32 value)
+{
+	uint8 digits = 1;
+
+	while(digits < 10 && value >= powers_of_ten[digits])
+	{
+		digits++;
+	}
+	return digits;
+}
+
+// value / 10^n rounded to the nearest, n from 1. Like write_number() each power of ten is
+// subtracted from the top place down instead of dividing, what is left is the remainder.
+// At most 9 subtractions a place, 10 places.
+static uint32 round_off(uint32 value, uint8 n)
+{
+	uint32 quotient = 0;
+	uint8 place = 10;
+
+	while(place-- > n)
+	{
+		while(value >= powers_of_ten[place])
+		{
+			value -= powers_of_ten[place];
+			quotient += powers_of_ten[place - n];
+		}
+	}
+	if(value >= powers_of_ten[n] >> 1)
+	{
+		quotient++;
+	}
+	return quotient;
+}
+
+// Writes value, which has decimals digits after the point in the base unit, with as many
+// significant digits as fit the 5 digit field, or fewer if the reading only has significant
+// ones, 0 for all of them. The prefix is picked from lowest to highest so that 1 to 3 digits
+// are in front of the dot. Returns the prefix for the units.
+//   1234 mV, decimals 3      ->  1.234 with no prefix (V)
+//   123 mV, decimals 3       ->  123 with PREFIX_MILLI
+//   4567800 cHz, decimals 2  ->  45.678 with PREFIX_KILO
+//   123000 cHz, 4 of them significant  ->  1.230 with PREFIX_KILO, not 1.2300
+int8 write_scaled(uint32 value, uint8 decimals, int8 lowest, int8 highest, uint8 significant)
+{
+	uint8 dropped = 0, digits;
+	int8 dot, prefix = 0;
+
+	// Round off the digits that do not fit or carry no information. Rounding up can carry
+	// into one more digit, 99996 to 10000, that one is a 0 and goes as well.
+	if(significant == 0 || significant > NUMBER_DIGITS)
+	{
+		significant = NUMBER_DIGITS;
+	}
+	digits = number_digits(value);
+	if(digits > significant)
+	{
+		dropped = digits - significant;
+		value = round_off(value, dropped);
+		digits = number_digits(value);
+		if(digits > significant)
+		{
+			value = round_off(value, 1);
+			dropped++;
+			digits--;
+		}
+	}
+
+	// Digits after the dot in the base unit, then move it by thousands until 1 to 3 digits
+	// are in front of it
+	dot = (int8) decimals - (int8) dropped;
+	while((int8) digits - dot > 3 && prefix < highest)
+	{
+		prefix++;
+		dot += 3;
+	}
+	while((int8) digits - dot < 1 && prefix > lowest)
+	{
+		prefix--;
+		dot -= 3;
+	}
 
-	// Enable the display
-  	write_spi(SHD_REG, 0x01);
+	// A prefix that cannot go any higher leaves no room for the digits, or one that cannot go
+	// any lower leaves more decimals than the field holds
+	if(dot < 0)
+	{
+		value = NUMBER_MAX;
+		dot = 0;
+	}
+	if(dot > 4)
+	{
+		value = round_off(value, dot - 4);
+		dot = 4;
+	}
+
+	write_number(value, (dot == 0) ? NO_DOT : dot);
+	return prefix;
 }
 
+// Displays a reading on the 8 digit 7-segment display, value is in the units of
+// measurement_value(): mV, or 0.01 Hz in frequency mode
+void display(uint32 value, uint8 mode)
+{
+	int8 prefix;
+
+	PROF_ENTER(PROF_DISPLAY);
+
+	switch(mode)
+	{
+		case DC_MODE: // mV below 1 V, V above
+			prefix = write_scaled(value, 3, PREFIX_MILLI, PREFIX_NONE, 0);
+			break;
+
+		case FREQ_MODE: // Hz, kHz or MHz, a counted reading only to the digits its edges give
+			prefix = write_scaled(value, 2, PREFIX_NONE, PREFIX_MEGA, measurement_digits());
+			break;
+
+		case AMP_MODE: // Always V, the units digits have no room for a prefix
+		case RMS_MODE:
+		case CAPTURE_MODE:
+			prefix = write_scaled(value, 3, PREFIX_NONE, PREFIX_NONE, 0);
+			break;
+
+		case SCAN_MODE: // Always mV
+			prefix = write_scaled(value, 3, PREFIX_MILLI, PREFIX_MILLI, 0);
+			break;
+
+		default:
+			prefix = write_scaled(value, 0, PREFIX_NONE, PREFIX_NONE, 0);
+			break;
+	}
+
+	// Write units to display depending on mode
+	write_mode_units(mode, prefix);
+	PROF_EXIT(PROF_DISPLAY);
+}
@@ -2,7 +2,7 @@
 #define DISPLAY_H
 
 #include "typedef.h"
-#include <ADUC841.H>
+#include "hal.h"
 
 //REGISTERS
 //Digit Resigsters
@@ -21,6 +21,10 @@
 #define SCAN_REG 0x0B // Scan Limit Register
 #define SHD_REG  0x0C // Shitdown Register
 
+// Register writes that can wait in the SPI queue, must be a power of 2
+#define SPI_QUEUE_SIZE 16
+#define SPI_QUEUE_MASK (SPI_QUEUE_SIZE - 1)
+
 // 7-SEG definations
 // Letters
 #define LETTER_P 0x67
@@ -31,6 +35,10 @@
 #define LETTER_M_2 0x11
 #define LETTER_V 0x3e
 #define LETTER_H 0x37
+#define LETTER_A 0x77
+#define LETTER_C 0x4E
+#define LETTER_K 0x57
+#define LETTER_BIG_M 0x76 // single digit M for MHz, the two digit m is used for mV
 
 // Numbers
 #define NUM_1 0x30
@@ -45,12 +53,26 @@
 #define NUM_0 0x7E
 
 #define NUM_dot 0x80
+#define NO_DOT  0xFF // dot_position for write_number() without a decimal point
+
+// Auto-ranging, the number field is 5 digits and the prefix a power of 1000
+#define NUMBER_MAX		99999
+#define NUMBER_DIGITS	5
+#define PREFIX_MILLI	-1
+#define PREFIX_NONE		0
+#define PREFIX_KILO		1
+#define PREFIX_MEGA		2
 
 // Start spi and initalizes the display
 void display_setup();
-void write_spi(uint8 address, uint8 data_to_write);
-void write_mode_units(uint8 mode);
-void display(uint16 value, uint8 mode);
+void write_spi(uint8 address, uint8 data_to_write); // queues a register write
+void write_digit(uint8 address, uint8 segment); // only sends digits that changed
+void write_mode_units(uint8 mode, int8 prefix);
+void display_marks(uint8 dots); // dots of the units digits, bit n is DIG_n
+void write_number(uint32 value, uint8 dot_position); // 5 digits, no division
+uint8 number_digits(uint32 value); // decimal digits of value, 1 for 0
+int8 write_scaled(uint32 value, uint8 decimals, int8 lowest, int8 highest, uint8 significant); // auto-ranges, returns the prefix
+void display(uint32 value, uint8 mode); // value in the units of measurement_value()
 
 
 #endif
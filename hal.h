@@ -0,0 +1,37 @@
+#ifndef HAL_H
+#define HAL_H
+
+// Hardware abstraction for the firmware. The Keil build (__C51__) uses the real ADuC841,
+// any other compiler gets the simulated part in host/ so the same sources run on a PC.
+//
+// The uvproj uses the SMALL memory model, so a variable without a memory type is in the
+// 128 bytes of directly addressed DATA, with the register banks, bits and overlaid locals.
+// Only what the ISRs touch on most runs is left there. Other ISR state is idata, reached
+// through R0, and what the foreground alone uses is xdata. The startup code does not clear
+// idata above 0x80 or xdata, so the setup and start functions set everything they rely on.
+
+#ifdef __C51__
+
+#include <ADUC841.H>
+
+sfr16 RCAP2 = 0xCA;		// Timer 2 reload register, 16-bit
+sbit  LOAD  = 0xB2;		// P3.2, latches the display shift register
+sbit  PROF_PIN = 0xB4;	// P3.4, spare pin for scope triggers, see profile.h
+
+// Interrupt service routine for a vector, optionally with its own register bank
+#define HAL_ISR(name, vector)				void name (void) interrupt vector
+#define HAL_ISR_USING(name, vector, bank)	void name (void) interrupt vector using bank
+
+// XRAM address of an xdata buffer, for the DMA pointer
+#define HAL_XDATA_ADDRESS(pointer)	((uint16) (pointer))
+
+// Called in wait loops that only poll variables set by an ISR, nothing to do on the target
+#define HAL_IDLE()
+
+#else
+
+#include "host/sfr_sim.h"
+
+#endif
+
+#endif
@@ -0,0 +1,14 @@
+// The simulated instrument on the command line, see sim.cpp for the options
+//
+//   build/host/instrument -s 02 -a 1:sine:50:2000:1250
+
+#include "host/sim.h"
+
+void firmware_main(void);
+
+int main(int argc, char **argv)
+{
+	sim_setup(argc, argv);
+	firmware_main();
+	return 0;
+}
@@ -0,0 +1,256 @@
+#ifndef HOST_SFR_SIM_H
+#define HOST_SFR_SIM_H
+
+// Firmware side of the host build, included through hal.h instead of <ADUC841.H>.
+// Every SFR and SFR bit is a proxy object whose reads and writes go to the simulated
+// ADuC841 in sim.cpp, so the firmware compiles unchanged as C++.
+
+#include "typedef.h"
+#include "host/sim.h"
+
+// Keil memory types and bit variables
+#define xdata
+#define idata
+#define code	const
+#define bit		bool
+
+// Byte SFR
+struct sfr_ref
+{
+	uint8 address;
+
+	explicit sfr_ref(uint8 a) : address(a) {}
+	operator uint8() const						{ return sim_read(address); }
+	sfr_ref &operator=(uint8 value)				{ sim_write(address, value); return *this; }
+	sfr_ref &operator=(const sfr_ref &other)	{ sim_write(address, (uint8) other); return *this; }
+	sfr_ref &operator|=(uint8 value)			{ sim_write(address, sim_read(address) | value); return *this; }
+	sfr_ref &operator&=(uint8 value)			{ sim_write(address, sim_read(address) & value); return *this; }
+	sfr_ref &operator^=(uint8 value)			{ sim_write(address, sim_read(address) ^ value); return *this; }
+	sfr_ref &operator+=(uint8 value)			{ sim_write(address, sim_read(address) + value); return *this; }
+	sfr_ref &operator-=(uint8 value)			{ sim_write(address, sim_read(address) - value); return *this; }
+};
+
+// 16-bit SFR pair, low byte at the address
+struct sfr16_ref
+{
+	uint8 address;
+
+	explicit sfr16_ref(uint8 a) : address(a) {}
+	operator uint16() const
+	{
+		uint8 low = sim_read(address);
+		return ((uint16) sim_read(address + 1) << 8) | low;
+	}
+	sfr16_ref &operator=(uint16 value)
+	{
+		sim_write(address, value & 0xFF);
+		sim_write(address + 1, value >> 8);
+		return *this;
+	}
+};
+
+// Bit of a bit addressable SFR, written as one read-modify-write like SETB/CLR
+struct sbit_ref
+{
+	uint8 address;
+	uint8 mask;
+
+	sbit_ref(uint8 a, uint8 m) : address(a), mask(m) {}
+	operator bool() const						{ return (sim_read(address) & mask) != 0; }
+	sbit_ref &operator=(bool value)				{ sim_write_bit(address, mask, value); return *this; }
+	sbit_ref &operator=(const sbit_ref &other)	{ sim_write_bit(address, mask, (bool) other); return *this; }
+};
+
+// Interrupt service routines register themselves with the simulator before main runs
+#define HAL_ISR(name, vector) \
+	void name (void); \
+	static sim_isr_entry name##_entry(vector, name); \
+	void name (void)
+#define HAL_ISR_USING(name, vector, bank)	HAL_ISR(name, vector)
+
+#define HAL_XDATA_ADDRESS(pointer)	sim_xdata_address(pointer)
+#define HAL_IDLE()					sim_idle()
+
+// ADuC841 SFRs, same names and addresses as ADUC841.H
+#define P0         sfr_ref(0x80)
+#define SP         sfr_ref(0x81)
+#define DPL        sfr_ref(0x82)
+#define DPH        sfr_ref(0x83)
+#define DPP        sfr_ref(0x84)
+#define PCON       sfr_ref(0x87)
+#define TCON       sfr_ref(0x88)
+#define TMOD       sfr_ref(0x89)
+#define TL0        sfr_ref(0x8A)
+#define TL1        sfr_ref(0x8B)
+#define TH0        sfr_ref(0x8C)
+#define TH1        sfr_ref(0x8D)
+#define P1         sfr_ref(0x90)
+#define I2CADD1    sfr_ref(0x91)
+#define I2CADD2    sfr_ref(0x92)
+#define I2CADD3    sfr_ref(0x93)
+#define SCON       sfr_ref(0x98)
+#define SBUF       sfr_ref(0x99)
+#define I2CDAT     sfr_ref(0x9A)
+#define I2CADD     sfr_ref(0x9B)
+#define T3FD       sfr_ref(0x9D)
+#define T3CON      sfr_ref(0x9E)
+#define P2         sfr_ref(0xA0)
+#define TIMECON    sfr_ref(0xA1)
+#define HTHSEC     sfr_ref(0xA2)
+#define SEC        sfr_ref(0xA3)
+#define MIN        sfr_ref(0xA4)
+#define HOUR       sfr_ref(0xA5)
+#define INTVAL     sfr_ref(0xA6)
+#define DPCON      sfr_ref(0xA7)
+#define IE         sfr_ref(0xA8)
+#define IEIP2      sfr_ref(0xA9)
+#define PWMCON     sfr_ref(0xAE)
+#define CFG841     sfr_ref(0xAF)
+#define P3         sfr_ref(0xB0)
+#define PWM0L      sfr_ref(0xB1)
+#define PWM0H      sfr_ref(0xB2)
+#define PWM1L      sfr_ref(0xB3)
+#define PWM1H      sfr_ref(0xB4)
+#define SPH        sfr_ref(0xB7)
+#define IP         sfr_ref(0xB8)
+#define ECON       sfr_ref(0xB9)
+#define EDATA1     sfr_ref(0xBC)
+#define EDATA2     sfr_ref(0xBD)
+#define EDATA3     sfr_ref(0xBE)
+#define EDATA4     sfr_ref(0xBF)
+#define WDCON      sfr_ref(0xC0)
+#define CHIPID     sfr_ref(0xC2)
+#define EADRL      sfr_ref(0xC6)
+#define EADRH      sfr_ref(0xC7)
+#define T2CON      sfr_ref(0xC8)
+#define RCAP2L     sfr_ref(0xCA)
+#define RCAP2H     sfr_ref(0xCB)
+#define TL2        sfr_ref(0xCC)
+#define TH2        sfr_ref(0xCD)
+#define PSW        sfr_ref(0xD0)
+#define DMAL       sfr_ref(0xD2)
+#define DMAH       sfr_ref(0xD3)
+#define DMAP       sfr_ref(0xD4)
+#define ADCCON2    sfr_ref(0xD8)
+#define ADCDATAL   sfr_ref(0xD9)
+#define ADCDATAH   sfr_ref(0xDA)
+#define PSMCON     sfr_ref(0xDF)
+#define ACC        sfr_ref(0xE0)
+#define DCON       sfr_ref(0xE8)
+#define I2CCON     sfr_ref(0xE8)
+#define ADCCON1    sfr_ref(0xEF)
+#define B          sfr_ref(0xF0)
+#define ADCOFSL    sfr_ref(0xF1)
+#define ADCOFSH    sfr_ref(0xF2)
+#define ADCGAINL   sfr_ref(0xF3)
+#define ADCGAINH   sfr_ref(0xF4)
+#define ADCCON3    sfr_ref(0xF5)
+#define SPIDAT     sfr_ref(0xF7)
+#define SPICON     sfr_ref(0xF8)
+#define DAC0L      sfr_ref(0xF9)
+#define DAC0H      sfr_ref(0xFA)
+#define DAC1L      sfr_ref(0xFB)
+#define DAC1H      sfr_ref(0xFC)
+#define DACCON     sfr_ref(0xFD)
+
+#define RCAP2      sfr16_ref(0xCA)
+
+#define TF1        sbit_ref(0x88, 0x80)
+#define TR1        sbit_ref(0x88, 0x40)
+#define TF0        sbit_ref(0x88, 0x20)
+#define TR0        sbit_ref(0x88, 0x10)
+#define IE1        sbit_ref(0x88, 0x08)
+#define IT1        sbit_ref(0x88, 0x04)
+#define IE0        sbit_ref(0x88, 0x02)
+#define IT0        sbit_ref(0x88, 0x01)
+#define T2EX       sbit_ref(0x90, 0x02)
+#define T2         sbit_ref(0x90, 0x01)
+#define SM0        sbit_ref(0x98, 0x80)
+#define SM1        sbit_ref(0x98, 0x40)
+#define SM2        sbit_ref(0x98, 0x20)
+#define REN        sbit_ref(0x98, 0x10)
+#define TB8        sbit_ref(0x98, 0x08)
+#define RB8        sbit_ref(0x98, 0x04)
+#define TI         sbit_ref(0x98, 0x02)
+#define RI         sbit_ref(0x98, 0x01)
+#define EA         sbit_ref(0xA8, 0x80)
+#define EADC       sbit_ref(0xA8, 0x40)
+#define ET2        sbit_ref(0xA8, 0x20)
+#define ES         sbit_ref(0xA8, 0x10)
+#define ET1        sbit_ref(0xA8, 0x08)
+#define EX1        sbit_ref(0xA8, 0x04)
+#define ET0        sbit_ref(0xA8, 0x02)
+#define EX0        sbit_ref(0xA8, 0x01)
+#define RD         sbit_ref(0xB0, 0x80)
+#define WR         sbit_ref(0xB0, 0x40)
+#define T1         sbit_ref(0xB0, 0x20)
+#define T0         sbit_ref(0xB0, 0x10)
+#define INT1       sbit_ref(0xB0, 0x08)
+#define INT0       sbit_ref(0xB0, 0x04)
+#define TXD        sbit_ref(0xB0, 0x02)
+#define RXD        sbit_ref(0xB0, 0x01)
+#define PSI        sbit_ref(0xB8, 0x80)
+#define PADC       sbit_ref(0xB8, 0x40)
+#define PT2        sbit_ref(0xB8, 0x20)
+#define PS         sbit_ref(0xB8, 0x10)
+#define PT1        sbit_ref(0xB8, 0x08)
+#define PX1        sbit_ref(0xB8, 0x04)
+#define PT0        sbit_ref(0xB8, 0x02)
+#define PX0        sbit_ref(0xB8, 0x01)
+#define PRE3       sbit_ref(0xC0, 0x80)
+#define PRE2       sbit_ref(0xC0, 0x40)
+#define PRE1       sbit_ref(0xC0, 0x20)
+#define PRE0       sbit_ref(0xC0, 0x10)
+#define WDIR       sbit_ref(0xC0, 0x08)
+#define WDS        sbit_ref(0xC0, 0x04)
+#define WDE        sbit_ref(0xC0, 0x02)
+#define WDWR       sbit_ref(0xC0, 0x01)
+#define TF2        sbit_ref(0xC8, 0x80)
+#define EXF2       sbit_ref(0xC8, 0x40)
+#define RCLK       sbit_ref(0xC8, 0x20)
+#define TCLK       sbit_ref(0xC8, 0x10)
+#define EXEN2      sbit_ref(0xC8, 0x08)
+#define TR2        sbit_ref(0xC8, 0x04)
+#define CNT2       sbit_ref(0xC8, 0x02)
+#define CAP2       sbit_ref(0xC8, 0x01)
+#define CY         sbit_ref(0xD0, 0x80)
+#define AC         sbit_ref(0xD0, 0x40)
+#define F0         sbit_ref(0xD0, 0x20)
+#define RS1        sbit_ref(0xD0, 0x10)
+#define RS0        sbit_ref(0xD0, 0x08)
+#define OV         sbit_ref(0xD0, 0x04)
+#define F1         sbit_ref(0xD0, 0x02)
+#define P          sbit_ref(0xD0, 0x01)
+#define ADCI       sbit_ref(0xD8, 0x80)
+#define DMA        sbit_ref(0xD8, 0x40)
+#define CCONV      sbit_ref(0xD8, 0x20)
+#define SCONV      sbit_ref(0xD8, 0x10)
+#define CS3        sbit_ref(0xD8, 0x08)
+#define CS2        sbit_ref(0xD8, 0x04)
+#define CS1        sbit_ref(0xD8, 0x02)
+#define CS0        sbit_ref(0xD8, 0x01)
+#define D1         sbit_ref(0xE8, 0x80)
+#define D1EN       sbit_ref(0xE8, 0x40)
+#define D0         sbit_ref(0xE8, 0x20)
+#define D0EN       sbit_ref(0xE8, 0x08)
+#define MDO        sbit_ref(0xE8, 0x80)
+#define MDE        sbit_ref(0xE8, 0x40)
+#define MCO        sbit_ref(0xE8, 0x20)
+#define MDI        sbit_ref(0xE8, 0x10)
+#define I2CM       sbit_ref(0xE8, 0x08)
+#define I2CRS      sbit_ref(0xE8, 0x04)
+#define I2CTX      sbit_ref(0xE8, 0x02)
+#define I2CI       sbit_ref(0xE8, 0x01)
+#define ISPI       sbit_ref(0xF8, 0x80)
+#define WCOL       sbit_ref(0xF8, 0x40)
+#define SPE        sbit_ref(0xF8, 0x20)
+#define SPIM       sbit_ref(0xF8, 0x10)
+#define CPOL       sbit_ref(0xF8, 0x08)
+#define CPHA       sbit_ref(0xF8, 0x04)
+#define SPR1       sbit_ref(0xF8, 0x02)
+#define SPR0       sbit_ref(0xF8, 0x01)
+
+#define LOAD       sbit_ref(0xB0, 0x04)	// P3.2, latches the display shift register
+#define PROF_PIN   sbit_ref(0xB0, 0x10)	// P3.4, spare pin for scope triggers
+
+#endif
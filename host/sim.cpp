@@ -0,0 +1,1145 @@
+// Simulated ADuC841 that runs the firmware on a workstation, built by "make host" and
+// "make test". instrument.cpp runs it from the command line, test/ from the tests.
+//
+// Models the parts of the chip the firmware uses: timers 0, 1 and 2 (timer 2 counting the
+// schmitt trigger output on T2), the ADC with calibration, single, continuous, timer 2
+// triggered and DMA conversions, the SPI port driving the MAX7219 latched from P3.2, and the mode switches
+// on P2, and the UART with its timer 3 baud rate. The ADC inputs are generated or played back from recorded files, and the display
+// is printed every time it changes. Simulated time only moves on SFR accesses and
+// HAL_IDLE(), see sim.h, so the run is deterministic and much faster than real time.
+//
+// usage: instrument [options]
+//   -t SECONDS             simulated run time, default 2
+//   -s HEX[@SECONDS]       P2 switches from a time on, repeat to change them, default 01
+//   -a CH:dc:MV            ADC channel input at a DC level
+//   -a CH:sine:HZ:MVPP:MV  sine with peak to peak and offset in mV, also square and triangle
+//   -a CH:file:PATH:RATE   recorded samples in mV, one per line at RATE per second, looped
+//   -a CH:KIND:ARGS@SECONDS  any of the above from a time on, repeat to step an input
+//                          AGND (11) and VREF (12) are inputs too, 0 and 2500 mV by default
+//   -x CH[:MV]             channel driving the schmitt trigger and its threshold,
+//                          default channel 1 at the offset of its input
+//   -n LSB                 rms noise added to every conversion, default 0
+//   -u FILE                where the UART output goes, default stdout
+//   -r TEXT[@SECONDS]      bytes received by the UART from a time on, can be repeated
+//   -q                     only print the final display
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "host/sim.h"
+#include "config.h"
+
+#define CORE_HZ			((double) F_OSC)	// core clock, the crystal the firmware is built for
+#define REF_MV			2500.0		// internal reference
+#define HYSTERESIS_MV	20.0		// schmitt trigger hysteresis
+#define T2_SAMPLE_CYCLES	2		// T2 pin sampling, a high and a low sample are needed per edge
+#define CAL_CYCLES		2000		// length of an ADC calibration
+
+// SFRs with a behaviour, the rest are plain storage
+enum
+{
+	SFR_TCON = 0x88, SFR_TMOD = 0x89, SFR_TL0 = 0x8A, SFR_TL1 = 0x8B, SFR_TH0 = 0x8C,
+	SFR_TH1 = 0x8D, SFR_P1 = 0x90, SFR_SCON = 0x98, SFR_SBUF = 0x99,
+	SFR_T3FD = 0x9D, SFR_T3CON = 0x9E, SFR_P2 = 0xA0, SFR_IE = 0xA8,
+	SFR_IEIP2 = 0xA9, SFR_P3 = 0xB0, SFR_IP = 0xB8, SFR_T2CON = 0xC8, SFR_RCAP2L = 0xCA,
+	SFR_RCAP2H = 0xCB, SFR_TL2 = 0xCC, SFR_TH2 = 0xCD, SFR_DMAL = 0xD2, SFR_DMAH = 0xD3,
+	SFR_ADCCON2 = 0xD8, SFR_ADCDATAL = 0xD9, SFR_ADCDATAH = 0xDA, SFR_ADCCON1 = 0xEF,
+	SFR_ADCOFSL = 0xF1, SFR_ADCOFSH = 0xF2, SFR_ADCGAINL = 0xF3, SFR_ADCGAINH = 0xF4,
+	SFR_ADCCON3 = 0xF5, SFR_SPIDAT = 0xF7, SFR_SPICON = 0xF8
+};
+
+static uint8    sfr[256];
+static uint64_t cycles;				// core cycles since reset
+static uint64_t end_cycles;
+
+// Interrupts
+struct source
+{
+	uint8 vector;
+	uint8 flag_sfr, flag_mask;		// request flags
+	uint8 enable_sfr, enable_mask;
+	uint8 priority_mask;			// bit in IP
+	bool  auto_clear;				// hardware clears the flag when vectoring
+};
+
+// In the ADuC841 polling order
+static const source sources[] =
+{
+	{6, SFR_ADCCON2, 0x80, SFR_IE,    0x40, 0x40, true},	// ADCI
+	{1, SFR_TCON,    0x20, SFR_IE,    0x02, 0x02, true},	// TF0
+	{3, SFR_TCON,    0x80, SFR_IE,    0x08, 0x08, true},	// TF1
+	{7, SFR_SPICON,  0x80, SFR_IEIP2, 0x01, 0x80, false},	// ISPI
+	{4, SFR_SCON,    0x03, SFR_IE,    0x10, 0x10, false},	// RI, TI
+	{5, SFR_T2CON,   0xC0, SFR_IE,    0x20, 0x20, false},	// TF2, EXF2
+};
+
+static void (*isr_table[16])(void);
+static int      isr_level = -1;		// priority of the running ISR, -1 in the foreground
+static uint64_t isr_calls[16];
+static uint64_t isr_cycles[16];		// including anything nested in it
+
+// Inputs
+enum { INPUT_DC, INPUT_SINE, INPUT_SQUARE, INPUT_TRIANGLE, INPUT_FILE };
+
+struct input
+{
+	int    kind;
+	double hz, mvpp, mv;			// mv is the level or the offset
+	std::vector<float> samples;		// INPUT_FILE, in mV
+	double rate;
+};
+
+static input    inputs[16];			// by ADC channel
+
+struct input_change
+{
+	uint64_t at;
+	uint8    channel;
+	input    in;
+};
+
+static std::vector<input_change> input_changes;	// in time order
+static size_t   next_input_change;
+static double   noise_lsb;
+static uint32   noise_state = 0x12345678;
+static uint8    schmitt_channel = 1;
+static double   schmitt_mv = -1;	// threshold, -1 for the offset of the input
+static bool     schmitt_high;
+
+// P2 switches
+struct switch_change
+{
+	uint64_t at;
+	uint8    value;
+};
+
+static std::vector<switch_change> switch_changes;
+static size_t   next_switch_change;
+static uint8    switches;
+
+// ADC
+static bool     adc_converting;
+static uint32   adc_remaining;		// cycles left in the current conversion
+static uint8    adc_conv_channel;	// channel latched when the conversion started
+static uint16   dma_address;		// XRAM address of the next DMA slot
+static uint32   cal_remaining;
+
+// SPI and the MAX7219
+static uint32   spi_remaining;		// cycles left in the current transfer, 0 when idle
+static uint8    spi_byte;
+static uint16   max7219_shift;		// last 16 bits clocked into the display
+static uint8    max7219[16];		// display registers
+static std::string shown;
+static uint64_t latched_at;			// last register latch, 0 once shown
+static bool     quiet;
+
+#define SETTLE_CYCLES	2000		// the display is printed once it has not changed for this long
+
+// UART
+static uint32   uart_remaining;		// cycles left sending the current byte, 0 when idle
+static uint8    uart_byte;
+static FILE    *uart_out;
+static uint32   uart_bit_cycles = 96;
+
+struct uart_input
+{
+	uint64_t    at;
+	std::string text;
+};
+
+static std::vector<uart_input> uart_inputs;		// in time order
+static size_t   uart_input_next;
+static size_t   uart_input_offset;	// bytes of uart_inputs[uart_input_next] already received
+static uint64_t uart_rx_at;			// when the next byte finishes arriving
+static uint8    uart_rx_byte;
+
+// xdata buffers handed to the DMA, the address is the index << 11 plus the offset
+static std::vector<uint8 *> xdata_regions;
+
+static std::chrono::steady_clock::time_point wall_start;
+
+// Calls at set times, for the tests
+struct timed_call
+{
+	uint64_t at;
+	void   (*fn)(void);
+};
+
+static std::vector<timed_call> timed_calls;		// in time order
+static size_t   next_timed_call;
+static uint32   spi_bits;			// bits clocked into the display since the last latch
+
+void (*sim_end)(void);
+void (*sim_uart_out)(uint8 byte);
+void (*sim_load)(uint16 word, uint8 bits);
+
+
+static double now()
+{
+	return cycles / CORE_HZ;
+}
+
+
+static void fatal(const char *message)
+{
+	fprintf(stderr, "sim: %s at %.6f s\n", message, now());
+	exit(1);
+}
+
+
+// Gaussian noise in LSB
+static double noise()
+{
+	double u1, u2;
+
+	noise_state ^= noise_state << 13;
+	noise_state ^= noise_state >> 17;
+	noise_state ^= noise_state << 5;
+	u1 = (noise_state + 1.0) / 4294967297.0;
+	noise_state ^= noise_state << 13;
+	noise_state ^= noise_state >> 17;
+	noise_state ^= noise_state << 5;
+	u2 = noise_state / 4294967296.0;
+	return noise_lsb * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+
+static double input_mV(uint8 channel, double t)
+{
+	const input &in = inputs[channel & 0x0F];
+	double phase;
+
+	switch (in.kind)
+	{
+		case INPUT_SINE:
+			return in.mv + in.mvpp / 2 * sin(2 * M_PI * in.hz * t);
+
+		case INPUT_SQUARE:
+			phase = fmod(in.hz * t, 1.0);
+			return in.mv + (phase < 0.5 ? in.mvpp / 2 : -in.mvpp / 2);
+
+		case INPUT_TRIANGLE:
+			phase = fmod(in.hz * t, 1.0);
+			return in.mv + in.mvpp * (phase < 0.5 ? 2 * phase - 0.5 : 1.5 - 2 * phase);
+
+		case INPUT_FILE:
+			return in.samples[(uint64_t) (t * in.rate) % in.samples.size()];
+
+		default:
+			return in.mv;
+	}
+}
+
+
+static uint16 convert(uint8 channel, double t)
+{
+	double code;
+
+	code = input_mV(channel, t) * 4096 / REF_MV;
+	if (noise_lsb > 0)
+	{
+		code += noise();
+	}
+
+	code = floor(code + 0.5);
+	return code < 0 ? 0 : code > 4095 ? 4095 : (uint16) code;
+}
+
+
+static uint8 *xdata_pointer(uint16 address)
+{
+	if ((address >> 11) >= xdata_regions.size())
+	{
+		fatal("DMA pointer outside any xdata buffer");
+	}
+	return xdata_regions[address >> 11] + (address & 0x7FF);
+}
+
+
+uint16 sim_xdata_address(void *pointer)
+{
+	size_t i;
+
+	for (i = 0; i < xdata_regions.size(); i++)
+	{
+		if (xdata_regions[i] == pointer)
+		{
+			return i << 11;
+		}
+	}
+	if (xdata_regions.size() == 32)
+	{
+		fatal("too many xdata buffers");
+	}
+	xdata_regions.push_back((uint8 *) pointer);
+	return (xdata_regions.size() - 1) << 11;
+}
+
+
+// ADC clocks per conversion set by ADCCON1, converted to core cycles
+static uint32 conversion_cycles()
+{
+	static const uint32 divider[4] = {32, 4, 8, 2};
+
+	return divider[(sfr[SFR_ADCCON1] >> 4) & 3] * (16 + ((sfr[SFR_ADCCON1] >> 2) & 3) + 1);
+}
+
+
+// Stores a finished conversion, t is when it completed
+static void finish_conversion(double t)
+{
+	uint16 *slot;
+	uint8 channel;
+	uint16 result;
+
+	if (sfr[SFR_ADCCON2] & 0x40)
+	{
+		// DMA, the channel comes from the slot and the result replaces it
+		slot = (uint16 *) xdata_pointer(dma_address);
+		channel = *slot >> 12;
+		*slot = ((uint16) channel << 12) | convert(channel, t);
+		dma_address += 2;
+
+		if ((*(uint16 *) xdata_pointer(dma_address) >> 12) == 0x0F)
+		{
+			sfr[SFR_ADCCON2] |= 0x80;		// stop command, the block is done
+			adc_converting = false;
+			return;
+		}
+	}
+	else
+	{
+		channel = adc_conv_channel;
+		result = convert(channel, t);
+		sfr[SFR_ADCDATAH] = (channel << 4) | (result >> 8);
+		sfr[SFR_ADCDATAL] = result & 0xFF;
+		sfr[SFR_ADCCON2] |= 0x80;
+
+		if (!(sfr[SFR_ADCCON2] & 0x20))
+		{
+			sfr[SFR_ADCCON2] &= ~0x10;		// single conversion done
+			adc_converting = false;
+			return;
+		}
+	}
+
+	// The next conversion starts straight away on whatever channel is selected now,
+	// a channel written by the ISR only applies to the one after it
+	adc_remaining = conversion_cycles();
+	adc_conv_channel = sfr[SFR_ADCCON2] & 0x0F;
+}
+
+
+static void adc_control(uint8 old, uint8 value)
+{
+	if ((value & 0x40) && !(old & 0x40))
+	{
+		dma_address = ((uint16) sfr[SFR_DMAH] << 8) | sfr[SFR_DMAL];
+	}
+
+	if (value & 0x30)
+	{
+		if (!adc_converting)
+		{
+			adc_converting = true;
+			adc_remaining = conversion_cycles();
+			adc_conv_channel = value & 0x0F;
+		}
+	}
+	else
+	{
+		adc_converting = false;
+	}
+}
+
+
+static std::string display_text()
+{
+	static const uint8 glyph_segments[] = {0x7E, 0x30, 0x6D, 0x79, 0x33, 0x5B, 0x5F, 0x70, 0x7F, 0x73,
+										   0x00, 0x67, 0x1C, 0x3E, 0x37, 0x77, 0x4E, 0x15, 0x57, 0x76};
+	static const char glyph_chars[] = "0123456789 PuVHACmkM";
+	std::string text;
+	uint8 segments;
+	size_t i;
+	int digit;
+
+	for (digit = 8; digit >= 1; digit--)
+	{
+		segments = max7219[digit] & 0x7F;
+
+		if (segments == 0x11 && !text.empty() && text.back() == 'm')
+		{
+			continue;						// right half of the m
+		}
+		if (segments == 0x6D && !text.empty() && text.back() == 'H')
+		{
+			text += 'Z';					// same segments as 2
+		}
+		else
+		{
+			for (i = 0; i < sizeof(glyph_segments) && glyph_segments[i] != segments; i++);
+			text += i < sizeof(glyph_segments) ? glyph_chars[i] : '?';
+		}
+
+		if (max7219[digit] & 0x80)
+		{
+			text += '.';
+		}
+	}
+	return text;
+}
+
+
+// LOAD went high, the display latches the last 16 bits
+static void max7219_load()
+{
+	max7219[(max7219_shift >> 8) & 0x0F] = max7219_shift & 0xFF;
+	latched_at = cycles;
+
+	if (sim_load)
+	{
+		sim_load(max7219_shift, spi_bits);
+	}
+	spi_bits = 0;
+}
+
+
+// Prints the display once a refresh has finished, so half written numbers are not shown
+static void max7219_show()
+{
+	std::string text;
+
+	latched_at = 0;
+	if (!(max7219[0x0C] & 0x01))
+	{
+		return;								// shut down
+	}
+	text = display_text();
+	if (text != shown)
+	{
+		shown = text;
+		if (!quiet)
+		{
+			printf("%10.4f s  [%s]\n", now(), text.c_str());
+		}
+	}
+}
+
+
+static void spi_start(uint8 value)
+{
+	static const uint32 divider[4] = {2, 4, 8, 16};
+
+	if (!(sfr[SFR_SPICON] & 0x20))
+	{
+		return;								// SPE off
+	}
+	if (spi_remaining)
+	{
+		sfr[SFR_SPICON] |= 0x40;			// WCOL
+		return;
+	}
+	spi_byte = value;
+	spi_remaining = 8 * divider[sfr[SFR_SPICON] & 0x03];
+}
+
+
+// Timer 3 baud rate, 115200 if it is not set up
+static void uart_baud()
+{
+	if (sfr[SFR_T3CON] & 0x80)
+	{
+		uart_bit_cycles = (16 << (sfr[SFR_T3CON] & 0x07)) * (64 + sfr[SFR_T3FD]) / 64;
+	}
+}
+
+
+// Mode 1 frame of 10 bits
+static void uart_start(uint8 value)
+{
+	uart_byte = value;
+	uart_remaining = 10 * uart_bit_cycles;
+}
+
+
+// Receives the next scheduled byte once a whole frame time has passed for it
+static void uart_receive()
+{
+	const uart_input *in;
+
+	if (uart_input_next == uart_inputs.size())
+	{
+		return;
+	}
+	in = &uart_inputs[uart_input_next];
+	if (uart_rx_at < in->at)
+	{
+		uart_rx_at = in->at + 10 * uart_bit_cycles;
+	}
+	if (cycles < uart_rx_at)
+	{
+		return;
+	}
+
+	if (sfr[SFR_SCON] & 0x10)				// REN
+	{
+		uart_rx_byte = in->text[uart_input_offset];
+		sfr[SFR_SCON] |= 0x01;				// RI
+	}
+	uart_rx_at += 10 * uart_bit_cycles;
+	if (++uart_input_offset == in->text.size())
+	{
+		uart_input_next++;
+		uart_input_offset = 0;
+	}
+}
+
+
+// Timer 0 or 1, mode from TMOD
+static void step_timer(uint32 n, uint8 mode, uint8 run, uint8 flag, uint8 tl, uint8 th)
+{
+	uint32 count;
+
+	if (!(sfr[SFR_TCON] & run))
+	{
+		return;
+	}
+
+	switch (mode)
+	{
+		case 0:		// 13-bit
+			count = ((uint32) sfr[th] << 5 | (sfr[tl] & 0x1F)) + n;
+			while (count >= 0x2000)
+			{
+				count -= 0x2000;
+				sfr[SFR_TCON] |= flag;
+			}
+			sfr[tl] = (sfr[tl] & 0xE0) | (count & 0x1F);
+			sfr[th] = count >> 5;
+			break;
+
+		case 1:		// 16-bit
+			count = ((uint32) sfr[th] << 8 | sfr[tl]) + n;
+			while (count >= 0x10000)
+			{
+				count -= 0x10000;
+				sfr[SFR_TCON] |= flag;
+			}
+			sfr[tl] = count & 0xFF;
+			sfr[th] = count >> 8;
+			break;
+
+		case 2:		// 8-bit auto reload from TH
+			count = sfr[tl] + n;
+			while (count >= 0x100)
+			{
+				count = count - 0x100 + sfr[th];
+				sfr[SFR_TCON] |= flag;
+			}
+			sfr[tl] = count;
+			break;
+	}
+}
+
+
+// Timer 2 counting core cycles or falling edges on T2, auto reload from RCAP2. With T2C set
+// in ADCCON1 an overflow also starts a single conversion.
+static void step_timer2(uint32 n, uint32 edges)
+{
+	uint32 count, after;
+
+	if (!(sfr[SFR_T2CON] & 0x04))
+	{
+		return;
+	}
+
+	count = ((uint32) sfr[SFR_TH2] << 8 | sfr[SFR_TL2]) + ((sfr[SFR_T2CON] & 0x02) ? edges : n);
+	while (count >= 0x10000)
+	{
+		count -= 0x10000;
+		if ((sfr[SFR_ADCCON1] & 0x02) && !adc_converting && !(sfr[SFR_ADCCON2] & 0x40))
+		{
+			// Counting core cycles the overflow was count cycles ago, edges are only seen at
+			// the end of the step. advance() takes the whole step off the conversion after this.
+			after = (sfr[SFR_T2CON] & 0x02) ? 0 : std::min(count, n);
+			adc_converting = true;
+			adc_remaining = conversion_cycles() + n - after;
+			adc_conv_channel = sfr[SFR_ADCCON2] & 0x0F;
+		}
+		count += (uint32) sfr[SFR_RCAP2H] << 8 | sfr[SFR_RCAP2L];
+		sfr[SFR_T2CON] |= 0x80;
+	}
+	sfr[SFR_TL2] = count & 0xFF;
+	sfr[SFR_TH2] = count >> 8;
+}
+
+
+static void finish()
+{
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+	int v;
+
+	if (sim_end)
+	{
+		sim_end();
+	}
+	if (latched_at)
+	{
+		max7219_show();
+	}
+	printf("%10.4f s  [%s] final\n", now(), shown.c_str());
+
+	fprintf(stderr, "simulated %.3f s in %.3f s, %.1fx real time\n", now(), wall, now() / wall);
+	fprintf(stderr, "vector      calls   cpu\n");
+	for (v = 0; v < 16; v++)
+	{
+		if (isr_calls[v])
+		{
+			fprintf(stderr, "%6d %10llu  %4.1f%%\n", v, (unsigned long long) isr_calls[v],
+					100.0 * isr_cycles[v] / cycles);
+		}
+	}
+	exit(0);
+}
+
+
+// Moves every peripheral on by n core cycles
+static void advance(uint32 n)
+{
+	double start = now();
+	double level, mv;
+	uint32 edges = 0;
+	uint32 left;
+	uint64_t sample;
+
+	cycles += n;
+
+	step_timer(n, sfr[SFR_TMOD] & 0x03, 0x10, 0x20, SFR_TL0, SFR_TH0);
+	step_timer(n, (sfr[SFR_TMOD] >> 4) & 0x03, 0x40, 0x80, SFR_TL1, SFR_TH1);
+
+	// Schmitt trigger on T2, sampled every T2_SAMPLE_CYCLES so a step can hold several edges
+	level = schmitt_mv >= 0 ? schmitt_mv : inputs[schmitt_channel].mv;
+	for (sample = cycles - n + T2_SAMPLE_CYCLES - (cycles - n) % T2_SAMPLE_CYCLES; sample <= cycles;
+		 sample += T2_SAMPLE_CYCLES)
+	{
+		mv = input_mV(schmitt_channel, sample / CORE_HZ);
+		if (schmitt_high && mv < level - HYSTERESIS_MV / 2)
+		{
+			schmitt_high = false;
+			edges++;
+		}
+		else if (!schmitt_high && mv > level + HYSTERESIS_MV / 2)
+		{
+			schmitt_high = true;
+		}
+	}
+	step_timer2(n, edges);
+
+	left = n;
+	while (adc_converting && left >= adc_remaining)
+	{
+		left -= adc_remaining;
+		finish_conversion(start + (n - left) / CORE_HZ);
+	}
+	if (adc_converting)
+	{
+		adc_remaining -= left;
+	}
+
+	if (cal_remaining)
+	{
+		cal_remaining = n >= cal_remaining ? 0 : cal_remaining - n;
+		if (!cal_remaining)
+		{
+			sfr[SFR_ADCCON3] &= ~0x01;
+		}
+	}
+
+	if (spi_remaining)
+	{
+		spi_remaining = n >= spi_remaining ? 0 : spi_remaining - n;
+		if (!spi_remaining)
+		{
+			max7219_shift = (max7219_shift << 8) | spi_byte;
+			spi_bits += 8;
+			sfr[SFR_SPICON] |= 0x80;		// ISPI
+		}
+	}
+
+	if (uart_remaining)
+	{
+		uart_remaining = n >= uart_remaining ? 0 : uart_remaining - n;
+		if (!uart_remaining)
+		{
+			if (sim_uart_out)
+			{
+				sim_uart_out(uart_byte);
+			}
+			else
+			{
+				fputc(uart_byte, uart_out);
+			}
+			sfr[SFR_SCON] |= 0x02;			// TI
+		}
+	}
+
+	uart_receive();
+
+	if (latched_at && cycles - latched_at >= SETTLE_CYCLES)
+	{
+		max7219_show();
+	}
+
+	while (next_switch_change < switch_changes.size() && switch_changes[next_switch_change].at <= cycles)
+	{
+		switches = switch_changes[next_switch_change++].value;
+	}
+
+	while (next_input_change < input_changes.size() && input_changes[next_input_change].at <= cycles)
+	{
+		inputs[input_changes[next_input_change].channel] = input_changes[next_input_change].in;
+		next_input_change++;
+	}
+
+	while (next_timed_call < timed_calls.size() && timed_calls[next_timed_call].at <= cycles)
+	{
+		timed_calls[next_timed_call++].fn();
+	}
+
+	if (cycles >= end_cycles)
+	{
+		finish();
+	}
+}
+
+
+static void access(uint32 n);		// an ISR can be interrupted, see below
+
+
+static void run_isr(const source &s, int level)
+{
+	uint64_t start = cycles;
+	int saved = isr_level;
+	int i;
+
+	if (!isr_table[s.vector])
+	{
+		fatal("interrupt taken with no ISR");
+	}
+	if (s.auto_clear)
+	{
+		sfr[s.flag_sfr] &= ~s.flag_mask;
+	}
+
+	// A high priority interrupt can come in after the first instruction of a low priority ISR
+	// and up to its RETI, so the entry and the register restores are charged an access at a
+	// time. Only the RETI itself holds it off.
+	isr_level = level;
+	for (i = 0; i < SIM_ISR_CYCLES / 2; i += SIM_ACCESS_CYCLES)
+	{
+		access(SIM_ACCESS_CYCLES);
+	}
+	isr_table[s.vector]();
+	for (i = SIM_ACCESS_CYCLES; i < SIM_ISR_CYCLES / 2; i += SIM_ACCESS_CYCLES)
+	{
+		access(SIM_ACCESS_CYCLES);
+	}
+	advance(SIM_ACCESS_CYCLES);
+	isr_level = saved;
+
+	isr_calls[s.vector]++;
+	isr_cycles[s.vector] += cycles - start;
+}
+
+
+// Takes the pending interrupt the running priority allows, high priority first. Like the
+// 8051, at most one is taken per access, so after a RETI the interrupted code always gets
+// to run a little before the next interrupt even when one is always pending.
+static void take_interrupts()
+{
+	const source *best;
+	int best_level, level;
+	size_t i;
+
+	if (!(sfr[SFR_IE] & 0x80))
+	{
+		return;
+	}
+
+	best = 0;
+	best_level = isr_level;
+	for (i = 0; i < sizeof(sources) / sizeof(sources[0]); i++)
+	{
+		const source &s = sources[i];
+		if (!(sfr[s.flag_sfr] & s.flag_mask) || !(sfr[s.enable_sfr] & s.enable_mask))
+		{
+			continue;
+		}
+		level = (sfr[SFR_IP] & s.priority_mask) ? 1 : 0;
+		if (level > best_level)
+		{
+			best = &s;
+			best_level = level;
+		}
+	}
+	if (best)
+	{
+		run_isr(*best, best_level);
+	}
+}
+
+
+static void access(uint32 n)
+{
+	advance(n);
+	take_interrupts();
+}
+
+
+static void store(uint8 address, uint8 value)
+{
+	uint8 old = sfr[address];
+
+	sfr[address] = value;
+
+	switch (address)
+	{
+		case SFR_ADCCON2:
+			adc_control(old, value);
+			break;
+
+		case SFR_ADCCON3:
+			if (value & 0x01)
+			{
+				// Calibration, leaves the hardware offset and gain at nominal
+				cal_remaining = CAL_CYCLES;
+				if (value & 0x02)
+				{
+					sfr[SFR_ADCGAINL] = 0x00;
+					sfr[SFR_ADCGAINH] = 0x20;
+				}
+				else
+				{
+					sfr[SFR_ADCOFSL] = 0x00;
+					sfr[SFR_ADCOFSH] = 0x20;
+				}
+			}
+			break;
+
+		case SFR_SPIDAT:
+			spi_start(value);
+			break;
+
+		case SFR_SBUF:
+			uart_start(value);
+			break;
+
+		case SFR_T3CON:
+		case SFR_T3FD:
+			uart_baud();
+			break;
+
+		case SFR_P3:
+			if (!(old & 0x04) && (value & 0x04))
+			{
+				max7219_load();
+			}
+			break;
+	}
+}
+
+
+uint8 sim_read(uint8 address)
+{
+	access(SIM_ACCESS_CYCLES);
+
+	switch (address)
+	{
+		case SFR_P1:
+			return schmitt_high ? 0x01 : 0x00;
+
+		case SFR_P2:
+			return sfr[SFR_P2] & switches;	// a closed switch pulls its pin high
+
+		case SFR_SBUF:
+			return uart_rx_byte;
+
+		default:
+			return sfr[address];
+	}
+}
+
+
+void sim_write(uint8 address, uint8 value)
+{
+	access(SIM_ACCESS_CYCLES);
+	store(address, value);
+}
+
+
+void sim_write_bit(uint8 address, uint8 mask, bool value)
+{
+	access(SIM_ACCESS_CYCLES);
+	store(address, value ? sfr[address] | mask : sfr[address] & ~mask);
+}
+
+
+// A wait loop is several instructions, each one a chance to take an interrupt
+void sim_idle()
+{
+	int i;
+
+	for (i = 0; i < SIM_IDLE_CYCLES / SIM_ACCESS_CYCLES; i++)
+	{
+		access(SIM_ACCESS_CYCLES);
+	}
+}
+
+
+void sim_register_isr(uint8 vector, void (*isr)(void))
+{
+	isr_table[vector & 0x0F] = isr;
+}
+
+
+double sim_time()
+{
+	return now();
+}
+
+
+void sim_at(double seconds, void (*fn)(void))
+{
+	timed_call call = {(uint64_t) (seconds * CORE_HZ), fn};
+
+	timed_calls.insert(std::upper_bound(timed_calls.begin() + next_timed_call, timed_calls.end(), call,
+										[](const timed_call &a, const timed_call &b) { return a.at < b.at; }),
+					   call);
+}
+
+
+uint64_t sim_isr_calls(uint8 vector)
+{
+	return isr_calls[vector & 0x0F];
+}
+
+
+uint8 sim_display_register(uint8 address)
+{
+	return max7219[address & 0x0F];
+}
+
+
+const char *sim_display()
+{
+	static std::string text;
+
+	text = display_text();
+	return text.c_str();
+}
+
+
+static void usage()
+{
+	fprintf(stderr,
+			"usage: instrument [-t SECONDS] [-s HEX[@SECONDS]]... [-a CH:KIND:ARGS[@SECONDS]]...\n"
+			"                  [-x CH[:MV]] [-n LSB] [-u FILE] [-r TEXT[@SECONDS]]... [-q]\n"
+			"  KIND is dc:MV, sine:HZ:MVPP:MV, square:HZ:MVPP:MV, triangle:HZ:MVPP:MV\n"
+			"  or file:PATH:RATE with one sample in mV per line\n");
+	exit(2);
+}
+
+
+static void load_samples(input &in, const char *path)
+{
+	char line[128];
+	FILE *file = fopen(path, "r");
+
+	if (!file)
+	{
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), file))
+	{
+		if (line[0] != '#' && line[0] != '\n')
+		{
+			in.samples.push_back(atof(line));
+		}
+	}
+	fclose(file);
+
+	if (in.samples.empty() || in.rate <= 0)
+	{
+		usage();
+	}
+
+	// The mean is the schmitt threshold if none is given
+	in.mv = 0;
+	for (float sample : in.samples)
+	{
+		in.mv += sample;
+	}
+	in.mv /= in.samples.size();
+}
+
+
+static void parse_input(char *arg)
+{
+	char *at = strrchr(arg, '@');
+	input_change change;
+	char *channel;
+
+	change.at = at ? (uint64_t) (atof(at + 1) * CORE_HZ) : 0;
+	if (at)
+	{
+		*at = 0;
+	}
+	channel = strtok(arg, ":");
+	char *kind = strtok(0, ":");
+	char *fields[3] = {strtok(0, ":"), strtok(0, ":"), strtok(0, ":")};
+	input in = input();
+
+	if (!channel || !kind || !fields[0] || atoi(channel) > 15)
+	{
+		usage();
+	}
+
+	if (!strcmp(kind, "dc"))
+	{
+		in.kind = INPUT_DC;
+		in.mv = atof(fields[0]);
+	}
+	else if (!strcmp(kind, "file"))
+	{
+		in.kind = INPUT_FILE;
+		in.rate = fields[1] ? atof(fields[1]) : 0;
+		load_samples(in, fields[0]);
+	}
+	else
+	{
+		if (!fields[1] || !fields[2])
+		{
+			usage();
+		}
+		in.kind = !strcmp(kind, "sine") ? INPUT_SINE : !strcmp(kind, "square") ? INPUT_SQUARE :
+				  !strcmp(kind, "triangle") ? INPUT_TRIANGLE : -1;
+		if (in.kind < 0)
+		{
+			usage();
+		}
+		in.hz = atof(fields[0]);
+		in.mvpp = atof(fields[1]);
+		in.mv = atof(fields[2]);
+	}
+
+	if (change.at)
+	{
+		change.channel = atoi(channel);
+		change.in = in;
+		input_changes.push_back(change);
+	}
+	else
+	{
+		inputs[atoi(channel)] = in;
+	}
+}
+
+
+// Reads the options and leaves the chip as it is out of reset
+void sim_setup(int argc, char **argv)
+{
+	double seconds = 2;
+	switch_change change;
+	uart_input received;
+	char *at;
+	int option;
+
+	// A 1 kHz signal on the amplitude channel and a DC level on the DC channel
+	inputs[1].kind = INPUT_SINE;
+	inputs[1].hz = 1000;
+	inputs[1].mvpp = 2000;
+	inputs[1].mv = 1250;
+	inputs[2].mv = 1000;
+	inputs[8].mv = 700;						// temperature sensor
+	inputs[12].mv = REF_MV;					// VREF, reads full scale
+	switches = 0x01;
+
+	uart_out = stdout;
+	while ((option = getopt(argc, argv, "t:s:a:x:n:u:r:q")) != -1)
+	{
+		switch (option)
+		{
+			case 't':
+				seconds = atof(optarg);
+				break;
+
+			case 's':
+				at = strchr(optarg, '@');
+				change.at = at ? (uint64_t) (atof(at + 1) * CORE_HZ) : 0;
+				change.value = strtoul(optarg, 0, 16);
+				switch_changes.push_back(change);
+				break;
+
+			case 'a':
+				parse_input(optarg);
+				break;
+
+			case 'x':
+				schmitt_channel = atoi(optarg) & 0x0F;
+				at = strchr(optarg, ':');
+				schmitt_mv = at ? atof(at + 1) : -1;
+				break;
+
+			case 'n':
+				noise_lsb = atof(optarg);
+				break;
+
+			case 'u':
+				uart_out = fopen(optarg, "w");
+				if (!uart_out)
+				{
+					perror(optarg);
+					exit(1);
+				}
+				break;
+
+			case 'r':
+				at = strrchr(optarg, '@');
+				received.at = at ? (uint64_t) (atof(at + 1) * CORE_HZ) : 0;
+				received.text.assign(optarg, at ? at - optarg : strlen(optarg));
+				if (!received.text.empty())
+				{
+					uart_inputs.push_back(received);
+				}
+				break;
+
+			case 'q':
+				quiet = true;
+				break;
+
+			default:
+				usage();
+		}
+	}
+	end_cycles = (uint64_t) (seconds * CORE_HZ);
+	std::stable_sort(switch_changes.begin(), switch_changes.end(),
+					 [](const switch_change &a, const switch_change &b) { return a.at < b.at; });
+	std::stable_sort(uart_inputs.begin(), uart_inputs.end(),
+					 [](const uart_input &a, const uart_input &b) { return a.at < b.at; });
+	std::stable_sort(input_changes.begin(), input_changes.end(),
+					 [](const input_change &a, const input_change &b) { return a.at < b.at; });
+
+	// Reset values
+	sfr[0x80] = sfr[SFR_P1] = sfr[SFR_P2] = sfr[SFR_P3] = 0xFF;
+	sfr[0x81] = 0x07;
+	sfr[SFR_SPICON] = 0x04;
+
+	wall_start = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,42 @@
+#ifndef HOST_SIM_H
+#define HOST_SIM_H
+
+// Interface between the firmware and the simulated ADuC841 in sim.cpp.
+// Each SFR access costs SIM_ACCESS_CYCLES of simulated time. The peripherals are brought
+// up to date and pending interrupts are taken before the access completes, so ISRs run
+// between SFR accesses and in sim_idle() the way they would between instructions.
+
+#include "typedef.h"
+
+#define SIM_ACCESS_CYCLES	2	// core cycles charged per SFR access
+#define SIM_IDLE_CYCLES		24	// core cycles charged per HAL_IDLE()
+#define SIM_ISR_CYCLES		20	// core cycles for vectoring, register saves and RETI
+
+uint8  sim_read(uint8 address);
+void   sim_write(uint8 address, uint8 value);
+void   sim_write_bit(uint8 address, uint8 mask, bool value);
+void   sim_idle();
+void   sim_register_isr(uint8 vector, void (*isr)(void));
+uint16 sim_xdata_address(void *pointer);
+
+// Used by instrument.cpp and the tests in test/, the firmware never calls these
+void   sim_setup(int argc, char **argv);	// the instrument options, see sim.cpp, then reset
+double sim_time();							// simulated seconds since reset
+void   sim_at(double seconds, void (*fn)(void));	// calls fn once the time is reached
+uint64_t sim_isr_calls(uint8 vector);		// ISR runs so far
+uint8  sim_display_register(uint8 address);	// MAX7219 register as last latched
+const char *sim_display();					// the display as text, as printed by the instrument
+
+// Test hooks, the instrument leaves them unset
+extern void (*sim_end)(void);				// at the end of the run instead of the summary, must not return
+extern void (*sim_uart_out)(uint8 byte);	// every byte sent, instead of writing the -u file
+extern void (*sim_load)(uint16 word, uint8 bits);	// every display latch with the last 16 bits
+												// clocked in and how many bits came since the last
+
+// Registers an ISR from a static initialiser, see HAL_ISR
+struct sim_isr_entry
+{
+	sim_isr_entry(uint8 vector, void (*isr)(void)) { sim_register_isr(vector, isr); }
+};
+
+#endif
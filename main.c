@@ -2,49 +2,103 @@
 	It uses a bit variable as a flag, to allow the interrupt service routine
 	and the foreground program to communicate in a safe way.   */
 
-#include <ADUC841.H>
+#include "hal.h"
 #include "typedef.h"
 #include "display.h"
 #include "measurements.h"
 #include "adc_interactions.h"
+#include "bench.h"
+#include "profile.h"
+#include "uart.h"
+#include "telemetry.h"
+#include "stats.h"
+
+#define REFRESH_TICKS	(100 / TICK_MS)	// scheduler ticks between display refreshes, 0.1 s
 
 void main (void)
 {
-	uint8 mode;
-	uint16 value, i, test = 0;
+	uint8 mode = 0xFF, new_mode, view, refresh = 0;
+	uint32 value = 0;
+	uint16 test = 0;
+	char command;
 
 	// Setup adc and display settings before going into the main loop
   adc_setup();
 	display_setup();
 	setup_frequency_timers();
 	P2 = 0xFF;
+	uart_setup();
+	telemetry_setup();
+	stats_clear();
+	PROF_SETUP();
+
+#ifdef BENCH
+	bench_run();	// prints the cycle counts on the UART, does not return
+#endif
 
-	// After setting up, main goes into an infinite loop
+	// After setting up, main goes into an infinite loop.
+	// Measurements run as tasks, nothing in here waits for a measurement period.
 	while (1)
 	{
-		mode = P2 & 0x07; // Read the 3 switch bits (P2.0, P2.1, P2.2)
+		HAL_IDLE();
+
+		// Single letter commands from the UART
+		command = uart_getc();
+		if (command != 0)
+		{
+			telemetry_command(command);
+			stats_command(command);
+			adc_command(command);
+			PROF_COMMAND(command);
+		}
+		telemetry_poll();
 
-		switch(mode)
+		if (scheduler_tick())
 		{
-			case DC_MODE: // First switch on, read ADC value in mV mode
-				for(i = 0; i < 60000; i++);
-				value = get_mDC_value();
-				break;
-
-			case FREQ_MODE: // Second switch on, read frequency value in Hz
-				value = get_frequency_value();
-				break;
-
-			case AMP_MODE: // Third switch on, read amplitude value
-				value = get_amplitiude_value();
-				break;
-
-			default: // All switches off, or more than one switch on, display 0
-				value = test;
-				test++;
-				break;
+			new_mode = P2 & 0x3F; // Read the 6 mode switch bits (P2.0 - P2.5)
+			view = P2 & STATS_VIEW_MASK; // P2.6 and P2.7 pick the live reading, min, max or hold
+
+			// A switch change restarts the measurement and shows the new units straight away
+			if (new_mode != mode)
+			{
+				mode = new_mode;
+				value = 0;
+				measurement_start(mode);
+				refresh = REFRESH_TICKS;
+			}
+
+			if (++refresh >= REFRESH_TICKS)
+			{
+				refresh = 0;
+
+				switch(mode)
+				{
+					case DC_MODE: // First switch on, read ADC value in mV mode
+					case FREQ_MODE: // Second switch on, read frequency value in Hz
+					case AMP_MODE: // Third switch on, read amplitude value
+					case RMS_MODE: // Fourth switch on, read true RMS value
+					case SCAN_MODE: // Fifth switch on, show each scanned adc channel in turn
+					case CAPTURE_MODE: // Sixth switch on, triggered traces on the UART
+						break;
+
+					default: // All switches off, or more than one switch on, display 0
+						value = test;
+						test++;
+						break;
+				}
+
+				// The units dots mark the view, the last for min, the one before for max, both for hold
+				display_marks(view >> 6);
+				display(stats_value(mode, view, value), mode);
+			}
 		}
 
-		display(value, mode);
+		if (measurement_poll())
+		{
+			value = measurement_value();
+			telemetry_reading(mode, value);
+			stats_update(mode, value);
+			measurement_start(mode);
+		}
 	}
 }
@@ -1,61 +1,408 @@
-#include <ADUC841.H>
+#include "hal.h"
 #include "typedef.h"
 #include "adc_interactions.h"
 #include "measurements.h"
+#include "bench.h"
+#include "profile.h"
+#include "telemetry.h"
+#include "display.h"
 
-#define PERIOD		-250		// 250 clock cycles interrupt period
-/* This negative value will be cast as an unsigned 8-bit integer below, and
-   this will result in a timer reload value of 6.  Counting up from that value,
-   the 8-bit timer will overflow after 250 clock cycles.  At a clock frequency
-   of 11.0592 MHz, that gives interrupt frequency 44.2368 kHz, period ~22.6 us.  */
-
-#define NUM_INTS	44240		// number of interrupts between events
-// This value gives event frequency almost exactly 10 Hz, period 0.1 s
+/* Timer 0 reloads with TIMER0_RELOAD, 6 for the 250 clock cycles of config.h.
+   Counting up from that value, the 8-bit timer overflows after TIMER0_CYCLES
+   clock cycles. At 11.0592 MHz that gives interrupt frequency 44.2368 kHz,
+   period ~22.6 us. The shortest frequency gate is GATE_INTS of these, 4424
+   for 100 ms, and the scheduler tick TICK_INTS, 442 for 10 ms.  */
 
 // These are global variables: static and available to all functions
-sfr16 RCAP2 = 0xCA;                 // Timer 2 reload register, 16-bit
 bit		period_over;		        // global variable - flag to signal event
+bit		period_running;		        // set while a measurement period is being timed
+bit		period_repeat;		        // restart the period by itself when it ends
+bit		dc_latch;			        // latch the adc sum at the end of every period
+bit		edge_sync;			        // schmitt edges open and close the adc window
+bit		tick_over;			        // set every scheduler tick
+uint16	tick_count;			        // interrupts since the last scheduler tick
+uint32 idata tick_total;			// scheduler ticks since reset
 uint16	period_count;		        // global variable to count interrupts
+uint16	period_length;		        // number of interrupts in the current period
+uint8	period_laps;		        // further lengths a frequency gate lasts for
 uint32  schmitt_count;	            // global variable - number of timer2 interrupts in one period
-uint16  frequency;		            // global variable - estimated frequency in Hz
+uint32 xdata frequency_centihz;     // last frequency measurement in 0.01 Hz
+bit     reciprocal;                 // time the edges instead of only counting them
+bit     t2_counting;                // timer 2 counts the edges itself, its ISR only sees overflows
+uint16  timer2_overflows;           // upper 16 bits of the hardware edge count
+uint16  timer1_overflows;           // upper 16 bits of the timer 1 timestamp
+uint32 idata first_edge_time;       // timestamp of the first edge in the period
+uint32 idata last_edge_time;        // timestamp of the latest edge in the period
+uint16 xdata amp_block[AMP_BLOCK_SIZE + 1]; // DMA buffer for the amplitude samples, plus stop command, and the capture ring
+
+// State of the running measurement task
+uint8 idata meas_mode;				// mode being measured
+uint8 xdata meas_state;				// one of the MEAS_ states below
+uint32 xdata meas_value;			// latest completed reading
+uint8 xdata meas_digits;			// significant digits of it, 0 for all that are shown
+uint16 xdata extra_gates;			// gates a slow frequency reading has been extended by
+uint8 xdata gate_step;				// the frequency gate is GATE_MS << gate_step
+uint16 xdata gate_first;			// core cycles from the start of the gate to its first interrupt
+uint16 xdata amp_max;				// running peak detector state
+uint16 xdata amp_min;
+uint32 idata dc_sum;				// adc sum and count latched at the end of a DC interval
+uint32 idata dc_count;
+uint16 idata dc_filtered;			// adc filter output latched with them
+uint8	sync_state;			        // one of the SYNC_ states below
+uint8	sync_windows;		        // minimum windows timed since the window was armed or opened
+bit		amp_sync;			        // timer 2 overflows every amp_periods edges, each one is a window edge
+bit		amp_dma;			        // no edges, the amplitude is measured over a fixed DMA window
+uint16 idata amp_periods;			// signal periods in an amplitude window
+bit		amp_window_done;	        // a window has closed, its extremes and length are below
+uint16 idata amp_close_min;			// extremes of the window
+uint16 idata amp_close_max;
+uint16 idata amp_close_ints;		// period_count and sync_windows when the window closed
+uint8 idata amp_close_windows;
+bit		ets_running;		        // equivalent time sampling, timer 2 alternates edges and delays
+bit		ets_delaying;		        // timer 2 is timing the delay of a point
+uint16	ets_point;			        // points started by the timer 2 ISR
+uint16 idata ets_count;				// points read into amp_block
+uint32 idata ets_delay;				// delay of the next point after its edge, 1/256 core cycles
+uint32 idata ets_step;				// added to the delay per point, 1/ETS_POINTS of a period
+uint8	ets_reload_high;	        // timer 2 load for the next delay
+uint8	ets_reload_low;
+uint8 xdata scan_index;				// position in scan_channels of the next channel shown
+uint8 xdata scan_channel;			// channel of the latest scan reading
+
+// Channels converted in scan mode, any of 0-7 and ADC_TEMP_CHANNEL in any order
+uint8 code scan_channels[] = {AMP_CHANNEL, DC_CHANNEL, ADC_TEMP_CHANNEL};
 
+#define MEAS_IDLE		0	// nothing to measure in this mode
+#define MEAS_RUNNING	1	// waiting for the period or samples
+#define MEAS_DONE		2	// meas_value holds a new reading
 
-// Timer 0 generates counts to 0.1s and generate an pulse
-void timer0 (void) interrupt 1 		    // interrupt vector at 000BH
+#define SYNC_ARMED		0	// the next edge opens the adc window
+#define SYNC_OPEN		1	// the first edge after the minimum window closes it
+#define SYNC_TIMED		2	// no edges, the window is timed instead
+#define SYNC_CLOSED		3	// the adc sums hold a whole number of periods
+
+
+// Timer 0 generates the scheduler tick and times the measurement period
+HAL_ISR(timer0, 1) 		    // interrupt vector at 000BH
 {
+#ifdef BENCH
+    // TL0 has counted on from the reload value since the overflow
+    uint8 latency = TL0 - (uint8) TIMER0_RELOAD;
+
+    if (latency < bench_latency_min) bench_latency_min = latency;
+    if (latency > bench_latency_max) bench_latency_max = latency;
+    bench_latency_sum += latency;
+    bench_latency_count++;
+#endif
+    PROF_ENTER(PROF_TIMER0);
+
+    tick_count++;
+    if (tick_count >= TICK_INTS)
+    {
+        tick_count = 0;
+        tick_over  = 1;
+        tick_total++;
+    }
+
     // Taken from blinky-timer-2.c
-    period_count++;					// increment interrupt counter
-    if (period_count >= NUM_INTS) 	// if enough interrupts have been counted
+    if (period_running)
     {
-        period_count = 0;			// reset the counter
-        period_over  = 1;			// set the flag - 0.1s has passed
+        period_count++;					// increment interrupt counter
+        if (period_count >= period_length) 	// if enough interrupts have been counted
+        {
+            period_count = 0;			// reset the counter
+            if (period_laps != 0)
+            {
+                period_laps--;          // a long frequency gate goes round again
+            }
+            else
+            {
+                period_over  = 1;			// set the flag - the period has passed
+                period_running = period_repeat;
+
+                if (edge_sync)
+                {
+                    sync_windows++;
+                }
+                else if (meas_mode != FREQ_MODE || !reciprocal || schmitt_count >= 2)
+                {
+                    // Freeze the edge count exactly at the end of the period. A timed
+                    // frequency gate still waiting for its second edge carries on, an edge
+                    // before frequency_poll() extends it would otherwise be lost.
+                    ET2 = 0;
+                    TR2 = 0;
+                }
 
-				// Turn off the timer
-        TR0 = 0;
+                // Hand the samples of this interval to the DC task and start the next one
+                if (dc_latch)
+                {
+                    dc_sum   = adc_sum;
+                    dc_count = adc_sum_count;
+                    dc_filtered = adc_filtered;
+                    adc_sum  = 0;
+                    adc_sum_count = 0;
+                }
+            }
+        }
     }
+    PROF_EXIT(PROF_TIMER0);
 }
 
 
-// Timer 2 counts the number of schmitt trigger edges in the input signal during each 0.1s period.
-void timer2 (void) interrupt 5
+// Timer 1 runs freely at the core clock, the overflows extend it to a 32-bit timestamp
+HAL_ISR(timer1, 3)
 {
+    timer1_overflows++;
+}
+
+
+// Timer 2 counts the number of schmitt trigger edges in the input signal during each gate.
+// Per edge it interrupts on every edge, and in reciprocal mode also timestamps the first and
+// last edge from timer 1. As a plain counter it only interrupts every 65536 edges.
+HAL_ISR(timer2, 5)
+{
+    uint8  high, low;
+    uint16 overflows, reload;
+
+    // Entered before the ETS path too, that adds the same few cycles to every point's delay
+    PROF_ENTER(PROF_TIMER2);
+    if (ets_running)
+    {
+        if (!ets_delaying && ADCI)
+        {
+            // The adc ISR has not taken the last result yet, a conversion now would
+            // overwrite it, so this point waits for the next edge
+            TF2 = 0;
+            TH2 = 0xFF;
+            TL2 = 0xFF;
+        }
+        else if (!ets_delaying)
+        {
+            // An edge. Timer 2 times the delay of this point at the core clock from here,
+            // high priority keeps that a fixed time after the edge, and the overflow at its
+            // end starts the conversion
+            TR2 = 0;
+            TF2 = 0;                // before it runs again, an edge straight after must count
+            CNT2 = 0;
+            TH2 = ets_reload_high;
+            TL2 = ets_reload_low;
+            ADCCON1 = ADC_CON1 | ADC_CON1_T2C;
+            TR2 = 1;
+            ets_delaying = 1;
+        }
+        else
+        {
+            // The conversion is running, count edges again with the delay of the next point
+            TR2 = 0;
+            TF2 = 0;
+            ADCCON1 = ADC_CON1;
+            CNT2 = 1;
+            TH2 = 0xFF;
+            TL2 = 0xFF;
+            ets_delaying = 0;
+            if (++ets_point != ETS_POINTS)
+            {
+                ets_delay += ets_step;
+                reload = -(uint16) (ets_delay >> 8);
+                ets_reload_high = reload >> 8;
+                ets_reload_low  = reload;
+                TR2 = 1;
+            }
+        }
+        PROF_EXIT(PROF_TIMER2);
+        return;
+    }
+
+    if (amp_sync)
+    {
+        // Timer 2 reloads to count amp_periods edges, so consecutive overflows are exactly
+        // that many whole periods apart. The adc ISR does not interrupt this one, so the
+        // extremes are copied in one piece.
+        if (sync_state == SYNC_ARMED && !edge_sync)
+        {
+            sync_state = SYNC_OPEN;     // under DMA it only matters that an edge came
+            ET2 = 0;
+        }
+        else if (sync_state == SYNC_ARMED)
+        {
+            adc_window_reset = 1;
+            adc_window_open  = 1;
+            sync_state   = SYNC_OPEN;
+            sync_windows = 0;
+            period_count = 0;
+        }
+        else if (sync_state == SYNC_OPEN)
+        {
+            // Hand the window to amplitude_poll() and open the next one on the same edge
+            amp_close_min = adc_peak_min;
+            amp_close_max = adc_peak_max;
+            amp_close_ints    = period_count;
+            amp_close_windows = sync_windows;
+            amp_window_done  = 1;
+            adc_window_reset = 1;
+            sync_windows = 0;
+            period_count = 0;
+        }
+        TF2 = 0;
+        PROF_EXIT(PROF_TIMER2);
+        return;
+    }
+
+    if (t2_counting)
+    {
+        timer2_overflows++;
+        TF2 = 0;
+        PROF_EXIT(PROF_TIMER2);
+        return;
+    }
+
+    if (reciprocal)
+    {
+        high = TH1;
+        low  = TL1;
+        if (high != TH1)            // TL1 rolled over between the reads, read again
+        {
+            high = TH1;
+            low  = TL1;
+        }
+        overflows = timer1_overflows;
+        if (TF1 && !(high & 0x80))  // timer 1 overflowed but its ISR has not run yet
+        {
+            overflows++;
+        }
+
+        last_edge_time = ((uint32) overflows << 16) | ((uint16) high << 8) | low;
+        if (schmitt_count == 0)
+        {
+            first_edge_time = last_edge_time;
+        }
+    }
+
+    if (edge_sync)
+    {
+        if (sync_state == SYNC_ARMED)
+        {
+            // Open the adc window on an edge and time the minimum window from here
+            adc_window_reset = 1;
+            adc_window_open  = 1;
+            sync_state   = SYNC_OPEN;
+            sync_windows = 0;
+            period_count = 0;
+        }
+        else if (sync_state == SYNC_OPEN && sync_windows > 0)
+        {
+            // First edge after the minimum window, the window holds whole periods
+            adc_window_open = 0;
+            sync_state = SYNC_CLOSED;
+        }
+    }
+
     schmitt_count++;                // increment the schmitt edge count for this period
     TF2 = 0;					        // clear interrupt flag
+    PROF_EXIT(PROF_TIMER2);
 }	// end timer2 interrupt service routine
 
 
+// Returns a*b/c without overflowing the 32-bit product, the result itself must fit in 32 bits
+static uint32 mul_div(uint32 a, uint32 b, uint32 c)
+{
+    uint32 q = 0;
+    uint32 r = 0;
+    uint32 a_q = a / c;
+    uint32 a_r = a % c;
+    uint8  i;
+
+    // Binary long multiplication, keeping the remainder below c at every step
+    for (i = 0; i < 32; i++)
+    {
+        q <<= 1;
+        r <<= 1;
+        if (r >= c)
+        {
+            r -= c;
+            q++;
+        }
+
+        if (b & 0x80000000L)
+        {
+            q += a_q;
+            r += a_r;
+            if (r >= c)
+            {
+                r -= c;
+                q++;
+            }
+        }
+        b <<= 1;
+    }
+
+    return q;
+}
+
+
+// Integer square root, rounded down
+uint16 isqrt(uint32 value)
+{
+    uint32 root = 0;
+    uint32 bit_value = 0x40000000L;
+
+    while (bit_value > value)
+    {
+        bit_value >>= 2;
+    }
+
+    while (bit_value != 0)
+    {
+        if (value >= root + bit_value)
+        {
+            value -= root + bit_value;
+            root = (root >> 1) + bit_value;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit_value >>= 2;
+    }
+
+    return (uint16) root;
+}
+
+
 void setup_frequency_timers()
 {
     period_over = 0;		            // initialize the flag to 0
+    period_running = 0;
+    period_repeat = 0;
+    dc_latch = 0;
+    edge_sync = 0;
     period_count = 0;		            // initialize the interrupt counter to 0
+    period_length = GATE_INTS;	        // initialize the period to the gate
+    period_laps = 0;
+    tick_over = 0;
+    tick_count = 0;
+    tick_total = 0;
     schmitt_count = 0;              // initialize the schmitt edge count to 0
-    frequency = 0;		              // initialize the frequency variable to 0
+    frequency_centihz = 0;
+    gate_step = 0;
+    reciprocal = 1;                 // start in reciprocal mode until the first reading
+    t2_counting = 0;
+    timer2_overflows = 0;
+    amp_sync = 0;
+    ets_running = 0;
+    amp_dma = !AMP_EDGE_SYNC;
+    amp_periods = AMP_MIN_PERIODS;
+    timer1_overflows = 0;
+    meas_mode = 0;
+    meas_state = MEAS_IDLE;
+    meas_value = 0;
+    meas_digits = 0;
 
     // Set up the timer 0 interrupt (Taken from blinky-timer-2.c)
-    TH0   = (unsigned char) PERIOD;		// set timer period
-    TL0   = (unsigned char) PERIOD;
+    TH0   = (unsigned char) TIMER0_RELOAD;	// set timer period
+    TL0   = (unsigned char) TIMER0_RELOAD;
     TMOD |= 0x02;		                // select mode 2
-    TR0   = 0;			                // OFF timer 0 (should be off until we start counting)
+    TR0   = 1;			                // timer 0 runs all the time, it drives the scheduler tick
     ET0   = 1;			                // enable timer 0 interrupt
     EA    = 1;			                // global interrupt enable
 
@@ -63,73 +410,888 @@ void setup_frequency_timers()
     T2CON = 0x06;                       // all zero except run control
     ET2   = 0;                          // disable timer 2 interrupt
     RCAP2 = 0xFFFF;                     // Set reload value to maximum, so it will overflow on every schmitt trigger edge
+    TH2   = 0xFF;                       // the reload only happens on an overflow, start there too
+    TL2   = 0xFF;
+
+    // Set up timer 1 as a free running 16-bit timer for timestamping edges
+    TMOD |= 0x10;                       // select mode 1
+    TR1   = 1;                          // start timer 1
+    ET1   = 1;                          // enable timer 1 interrupt to extend it to 32 bits
+}
+
+
+// Returns 1 once per scheduler tick
+bit scheduler_tick()
+{
+    if (!tick_over)
+    {
+        return 0;
+    }
+    tick_over = 0;
+    return 1;
 }
 
 
-uint16 get_frequency_value()
+// Scheduler ticks since reset, wraps after more than a year
+uint32 scheduler_time()
+{
+    uint32 ticks;
+
+    ET0 = 0;                        // 4 bytes written by the timer 0 ISR
+    ticks = tick_total;
+    ET0 = 1;
+    return ticks;
+}
+
+
+// Starts timing a measurement period of length timer 0 interrupts, once or over and over
+static void start_period(uint16 length, bit repeat)
+{
+    ET0 = 0;                        // keep the ISR out while the period is reset
+    period_length  = length;
+    period_laps    = 0;
+    period_count   = 0;
+    period_over    = 0;
+    period_running = 1;
+    period_repeat  = repeat;
+    ET0 = 1;
+}
+
+
+// Starts counting schmitt edges with an interrupt on every edge, a stale TF2 would
+// otherwise count as an edge
+static void start_edges()
 {
-    TR0   = 1;			    // Start timer 0
-    ET2   = 1;              // enable timer 2 interrupt
 	P1 		= 0x00;         // Start P1
-    while(!period_over);    // Wait for the timer to finish
-    ET2   = 0;              // Turn off timer 2 interrupt
+    t2_counting = 0;
+    RCAP2 = 0xFFFF;                 // overflow, and interrupt, on every edge
+    TH2   = 0xFF;
+    TL2   = 0xFF;
+    schmitt_count = 0;
+    TF2 = 0;
+    ET2 = 1;                        // enable timer 2 interrupt
+    TR2 = 1;
+}
+
+
+// Starts counting schmitt edges in timer 2 itself. The interrupt rate no longer depends on
+// the input, only the overflows every 65536 edges are counted by the ISR.
+static void start_counter()
+{
+	P1 		= 0x00;
+    TR2 = 0;
+    t2_counting = 1;
+    RCAP2 = 0x0000;
+    TH2   = 0x00;
+    TL2   = 0x00;
+    timer2_overflows = 0;
+    TF2 = 0;
+    ET2 = 1;
+    TR2 = 1;
+}
+
+
+// Starts timer 2 interrupting once every edges schmitt edges, the first edge overflows at once
+static void start_window_counter(uint16 edges)
+{
+	P1 		= 0x00;
+    TR2 = 0;
+    t2_counting = 0;
+    RCAP2 = -edges;
+    TH2   = 0xFF;
+    TL2   = 0xFF;
+    TF2 = 0;
+    ET2 = 1;
+    TR2 = 1;
+}
+
+
+// Edges counted by start_counter(), timer 2 must be stopped
+static uint32 counter_edges()
+{
+    uint32 edges = ((uint32) timer2_overflows << 16) | ((uint16) TH2 << 8) | TL2;
+
+    if (TF2)
+    {
+        edges += 0x10000L;          // overflowed after the gate turned the interrupt off
+        TF2 = 0;
+    }
+    return edges;
+}
+
+
+// Starts a frequency gate of 2^gate_step shortest gates. The longer ones do not fit the
+// 16 bit period counter, timer 0 goes round the shortest gate that many times instead.
+// The gate starts between two interrupts, so the part up to the first one is measured.
+static void start_gate()
+{
+    uint8 low;
+
+    ET0 = 0;                        // keep the ISR out while the period is reset
+    period_length  = GATE_INTS;
+    period_laps    = (1 << gate_step) - 1;
+    period_count   = 0;
+    period_over    = 0;
+    period_running = 1;
+    period_repeat  = 0;
+    low = TL0;                      // before TF0, so an overflow in between is seen
+    gate_first = TF0 ? 0 : 256 - low;   // a waiting overflow interrupts straight away
+    ET0 = 1;
+}
+
+
+// Picks the gate of the next counted reading from the edges of this one. A longer gate counts
+// more edges for a finer reading, a shorter one gives more readings a second. Like
+// amplitude_adapt() the gate is doubled or halved until it would hold GATE_EDGES to 4 times
+// that, so a steady input does not make it switch back and forth.
+static void gate_adapt(uint32 edges)
+{
+    while (edges < GATE_EDGES && gate_step < GATE_MAX_STEP)
+    {
+        edges <<= 1;
+        gate_step++;
+    }
+    while (edges >= 4 * GATE_EDGES && gate_step > 0)
+    {
+        edges >>= 1;
+        gate_step--;
+    }
+}
+
+
+// Edges counted over the gate to 0.01 Hz. The gate is GATE_MS rounded to whole timer 0
+// interrupts, less the part of the first one it started too late for. Its length in core
+// cycles is divided by rather than GATE_MS, otherwise the difference would show in the last
+// digit of a long gate.
+static uint32 gate_centihz(uint32 edges)
+{
+    return mul_div(edges, 100 * TIMER_CLOCK, (GATE_CYCLES << gate_step) - TIMER0_CYCLES + gate_first);
+}
+
+
+// Reciprocal readings need the edge timestamps, high frequencies are only counted
+static void frequency_start()
+{
+    // The gate starts first, so it can still end if every edge interrupts at a rate the
+    // foreground cannot keep up with
+    extra_gates = 0;
+    start_gate();
+    if (reciprocal)
+    {
+        start_edges();
+    }
+    else
+    {
+        start_counter();
+    }
+}
+
+
+// Frequency in 0.01 Hz.
+// High frequencies are counted over the gate, low frequencies are timed from the first to
+// the last edge in the gate with timer 1, which gives sub-Hz resolution from the same gate.
+// The mode and the gate for the next reading are picked from the edges in this one. Timed
+// readings resolve one core cycle whatever the gate, so they keep the shortest one.
+static bit frequency_poll()
+{
+    if (t2_counting && !period_over && gate_step > 0 && timer2_overflows != 0)
+    {
+        // The input sped up during a long gate. Any overflow means more than 65536 edges,
+        // more than the 4 * GATE_EDGES gate_adapt() keeps, so start again on the shortest
+        // gate instead of waiting it out.
+        ET2 = 0;
+        TR2 = 0;
+        gate_step = 0;
+        frequency_start();
+        return 0;
+    }
+
+    if (reciprocal && !period_over && extra_gates > 0 && schmitt_count >= 2)
+    {
+        ET2 = 0;                    // second edge of an extended gate has arrived
+        TR2 = 0;
+        period_running = 0;
+    }
+    else if (!period_over)
+    {
+        return 0;
+    }
+    else if (reciprocal && schmitt_count < 2 && extra_gates < RECIP_WAIT_GATES)
+    {
+        // Very slow signals need a second edge before a period can be timed
+        extra_gates++;
+        ET2 = 1;
+        TR2 = 1;
+        start_period(GATE_INTS, 0);
+        return 0;
+    }
+
+    ET2 = 0;                        // a timed gate may still be running, see timer0
+    TR2 = 0;
+    if (t2_counting)
+    {
+        schmitt_count = counter_edges();
+    }
+
+    meas_digits = 0;                // a timed reading resolves a core cycle, more than is shown
+    if (reciprocal && schmitt_count >= 2 && schmitt_count <= RECIP_MAX_EDGES)
+    {
+        // (edges - 1) whole periods between the first and last edge
+        frequency_centihz = mul_div((schmitt_count - 1) * 100, TIMER_CLOCK, last_edge_time - first_edge_time);
+    }
+    else if (reciprocal && schmitt_count < 2)
+    {
+        frequency_centihz = 0; // no signal
+    }
+    else
+    {
+        // Good to one edge in the gate, so the edges have as many digits as the reading
+        frequency_centihz = gate_centihz(schmitt_count);
+        meas_digits = number_digits(schmitt_count);
+    }
 
-	frequency = schmitt_count;	// calculate frequency in Hz, based on period count and interrupt period
-    schmitt_count = 0;	        // reset the schmitt count for the next 0.1s period
+    // The interrupt rate decides, so the edges are compared per shortest gate
+    reciprocal = (schmitt_count >> gate_step) <= RECIP_MAX_EDGES;
+    if (reciprocal)
+    {
+        gate_step = 0;
+    }
+    else
+    {
+        gate_adapt(schmitt_count);
+    }
     period_over = 0;            // reset the period over flag for the next period
 
-    return frequency;
+    meas_value = frequency_centihz;
+    return 1;
+}
+
+
+// Restarts the whole period windows, the next edge opens the first one
+static void amplitude_sync_start()
+{
+    ET2 = 0;
+    adc_window_open = 0;
+    amp_window_done = 0;
+    sync_state   = SYNC_ARMED;
+    sync_windows = 0;
+    amp_sync = 1;
+    start_window_counter(amp_periods);
 }
 
 
 //There can be issue with this if the input voltage is negative,
 //the circuit should insure this dos not happen but idk, will have to test
-uint16 get_amplitiude_value()
+static void amplitude_start()
 {
+    // The windows follow each other by themselves once they are running
+    if (amp_sync && edge_sync)
+    {
+        return;
+    }
+
 	// ADC value is always positive, so we can initialize min to max value,
 	// and max to min value, and then update them as we read values from the ADC.
-    uint16 adc_max = 0;
-    uint16 adc_min = 0xFFFF;
-    uint32 peak    = 0;
-    uint16 adc_value = 0;
+    amp_max = 0;
+    amp_min = 0xFFFF;
+
+    if (amp_dma)
+    {
+        // Every DMA slot converts adc channel 1
+        adc_dma_setup(amp_block, AMP_BLOCK_SIZE, AMP_CHANNEL);
+
+        start_period(AMP_WINDOW_INTS, 0);
+        adc_dma_start(amp_block);
+    }
+    else
+    {
+        // The adc ISR tracks the extremes while the edges hold the window open
+        adc_start(AMP_CHANNEL, ADC_SINK_PEAK);
+        start_period(AMP_WINDOW_INTS, 1);
+        edge_sync = 1;
+    }
+
+#if AMP_EDGE_SYNC
+    // Also runs under DMA, so the next reading goes back to whole periods once edges return
+    amplitude_sync_start();
+#endif
+}
+
+
+#if AMP_ETS
+// Starts equivalent time sampling of the amplitude channel, window is the length of the last
+// window in timer 0 interrupts, which held amp_periods periods
+static void ets_start(uint32 window)
+{
+    uint16 reload = -(uint16) ETS_MIN_DELAY;
+
+    ET2 = 0;
+    edge_sync = 0;
+    amp_sync = 0;
+
+    // The period in 1/256 core cycles, ETS_POINTS steps of the delay cover one of them
+    ets_step  = window * ((uint32) TIMER0_CYCLES << 8) / amp_periods / ETS_POINTS;
+    ets_delay = (uint32) ETS_MIN_DELAY << 8;
+    ets_reload_high = reload >> 8;
+    ets_reload_low  = reload;
+    ets_point = 0;
+    ets_count = 0;
+    ets_delaying = 0;
+
+    adc_triggered_start(AMP_CHANNEL, ADC_SINK_RING);
+    start_period(AMP_WINDOW_INTS, 0);   // gives up if the edges stop
+
+    // Every edge interrupts until the delay takes over, RCAP2 only matters after the
+    // delay and the ISR stops the timer long before it overflows again
+    TR2 = 0;
+    CNT2 = 1;
+    RCAP2 = 0x0000;
+    TH2 = 0xFF;
+    TL2 = 0xFF;
+    TF2 = 0;
+    ets_running = 1;
+    PT2 = 1;
+    ET2 = 1;
+    TR2 = 1;
+}
+#endif
+
+
+static void ets_stop()
+{
+    ET2 = 0;
+    TR2 = 0;
+    PT2 = 0;
+    CNT2 = 1;
+    ets_running = 0;
+    adc_stop();
+}
+
+
+// Picks the number of periods for the next window from the length of the last one, so it
+// lasts from AMP_MIN_WINDOW_INTS to 4 times that. Returns 1 if amp_periods changed.
+static bit amplitude_adapt(uint32 window)
+{
+    uint16 periods = amp_periods;
+
+    while (window < AMP_MIN_WINDOW_INTS && amp_periods < AMP_MAX_PERIODS)
+    {
+        amp_periods <<= 1;
+        window <<= 1;
+    }
+    while (window >= 4 * AMP_MIN_WINDOW_INTS && amp_periods > AMP_MIN_PERIODS)
+    {
+        amp_periods >>= 1;
+        window >>= 1;
+    }
+    return amp_periods != periods;
+}
 
-    // Select adc channel 1
-    ADCCON2 = 0x01;
 
-    // Start timer 0
-    TR0 = 1;
+// Peak to peak over the whole periods between two timer 2 overflows. Without an edge for
+// a whole AMP_WINDOW_INTS the input is DC or too slow, and the fixed DMA window takes over.
+static bit amplitude_sync_poll()
+{
+    bit no_edges = 0, stopped = 0, done = 0;
+    uint32 window;
+
+    EA = 0;                         // shared with both timer ISRs
+    if (sync_state == SYNC_ARMED && sync_windows > 0)
+    {
+        no_edges = 1;
+    }
+    else if (sync_state == SYNC_OPEN && sync_windows > RECIP_TIMEOUT)
+    {
+        // The edges stopped while the window was open, keep what it has and start over
+        amp_close_min = adc_peak_min;
+        amp_close_max = adc_peak_max;
+        amp_close_ints    = period_count;
+        amp_close_windows = sync_windows;
+        amp_window_done = 1;
+        stopped = 1;
+    }
+    if (amp_window_done)
+    {
+        amp_window_done = 0;
+        amp_min = amp_close_min;
+        amp_max = amp_close_max;
+        window  = (uint32) amp_close_windows * AMP_WINDOW_INTS + amp_close_ints;
+        done = 1;
+    }
+    EA = 1;
+
+    if (no_edges)
+    {
+        amp_periods = AMP_MIN_PERIODS;
+        amp_dma = 1;
+        edge_sync = 0;
+        amplitude_start();
+        return 0;
+    }
+    if (!done)
+    {
+        return 0;
+    }
+    if (stopped)
+    {
+        amp_periods = AMP_MIN_PERIODS;
+        amplitude_sync_start();
+        return 1;
+    }
 
-    // While timer 0 is counting
-    while(!period_over)
+#if AMP_ETS
+    if (window >= AMP_MIN_WINDOW_INTS &&
+        window * (uint32) TIMER0_CYCLES < (uint32) amp_periods * (ETS_CONVERSIONS * ADC_PEAK_CYCLES))
     {
-        adc_value = get_adc_value(1); //with an averaging of 5, this in theory should be 55 KHz
+        // Too few conversions per period to rely on, take a trace of one period instead.
+        // The windows start again from the adapted number of periods after it.
+        ets_start(window);
+        amplitude_adapt(window);
+        return 0;
+    }
+#endif
 
-        // Compare previous adc_value
-        adc_max = adc_value > adc_max ? adc_value : adc_max;
-        adc_min = adc_value < adc_min ? adc_value : adc_min;
+    // A different number of periods needs timer 2 reloaded from the next edge. A window
+    // that was too short has too few conversions to have come near both peaks.
+    if (amplitude_adapt(window))
+    {
+        amplitude_sync_start();
+        if (window < AMP_MIN_WINDOW_INTS)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+// While the period runs, capture whole blocks and reduce each one as it completes
+static bit amplitude_dma_poll()
+{
+    if (!adc_dma_done())
+    {
+        return 0;
+    }
+    adc_block_minmax(amp_block, AMP_BLOCK_SIZE, &amp_min, &amp_max);
+    telemetry_block(amp_block, AMP_BLOCK_SIZE, AMP_CHANNEL);
+
+    if (!period_over)
+    {
+        adc_dma_start(amp_block);
+        return 0;
     }
 	period_over = 0;
 
+#if AMP_EDGE_SYNC
+    // An edge came during the window, the next reading is synchronised again
+    ET2 = 0;
+    amp_sync = 0;
+    amp_dma = sync_state == SYNC_ARMED;
+#endif
+    return 1;
+}
+
+
+// Reads the points into amp_block as they are converted, once they are all in the block
+// is one period of the input and goes out as a trace starting at the edge
+static bit ets_poll()
+{
+    while (ets_count < ETS_POINTS && adc_available())
+    {
+        amp_block[ets_count++] = adc_read();
+    }
+
+    if (ets_count < ETS_POINTS)
+    {
+        if (period_over)
+        {
+            // The edges stopped before every point was taken
+            ets_stop();
+            amplitude_start();
+        }
+        return 0;
+    }
+    ets_stop();
+
+    amp_min = 0xFFFF;
+    amp_max = 0;
+    adc_block_minmax(amp_block, ETS_POINTS, &amp_min, &amp_max);
+    if (telemetry_blocks)
+    {
+        telemetry_trace(amp_block, 0, 0, AMP_CHANNEL);	// raw samples like the blocks it replaces
+    }
+
+    // The next amplitude_start() times the period again for the next trace
+    return 1;
+}
+
+
+static bit amplitude_poll()
+{
+    uint32 peak;
+
+    if (ets_running ? !ets_poll() : amp_dma ? !amplitude_dma_poll() : !amplitude_sync_poll())
+    {
+        return 0;
+    }
+
     // Need to double check this, some nuances with the circuit
-    peak = 2*(adc_max - adc_min);
+    peak = 2*(amp_max - amp_min);
 
     // Convert peak to mv
-	  peak = peak * 2500L/4096L;
-    return (uint16) peak;
+	  peak = adc_span_to_mV(peak);
+    meas_value = peak;
+    return 1;
+}
+
+
+// DC mode reads on a fixed cadence from timer 0. The adc sums every conversion and
+// timer 0 latches the sum at the end of each interval, so a reading averages all of them.
+// The conversions run at ADC_CON1_SLOW, ~1700 of them and ~100 oversampled results per
+// interval, with the ISR well inside the 640 cycles of each.
+static void dc_start()
+{
+    // Only the first reading sets up, after that the interval repeats by itself
+    if (period_running)
+    {
+        return;
+    }
+
+    // Convert adc channel 2 continuously
+    adc_start(DC_CHANNEL, ADC_SINK_SUM);
+
+    start_period(DC_INTERVAL_INTS, 1);
+    ET0 = 0;
+    dc_latch = 1;
+    ET0 = 1;
 }
 
-// Gets DC value in mv
-uint16 get_mDC_value()
+
+// Gets DC value in mv at the end of each interval
+static bit dc_poll()
 {
     uint16 adc_value = 0;
     uint32 mv = 0;
+    uint32 sum, count;
+
+    if (!period_over)
+    {
+        return 0;
+    }
+
+    ET0 = 0;                    // dc_sum and dc_count are written by the timer 0 ISR
+    period_over = 0;
+    sum   = dc_sum;
+    count = dc_count;
+    adc_value = dc_filtered;
+    ET0 = 1;
+
+    // With a filter selected the reading is its output at the end of the interval,
+    // otherwise the mean of every result in the interval
+    if (adc_filter == ADC_FILTER_NONE && count != 0)
+    {
+        adc_value = sum / count; //mean the value
+    }
+
+	  // Convert the oversampled value to mV
+	  mv = adc_oversampled_to_mV(adc_value);
+    meas_value = mv;
+    return 1;
+}
+
+
+// True RMS over a window of whole signal periods. The adc ISR sums the deviations from
+// adc_ref and their squares, and the schmitt edge ISR opens the window on one edge and
+// closes it on the first edge after RMS_WINDOW_INTS, so the reading does not depend on
+// where in the period the window happens to start and stop.
+static void rms_start()
+{
+    adc_start(AMP_CHANNEL, ADC_SINK_SQUARES);
+    adc_window_open = 0;
+
+    sync_state   = SYNC_ARMED;
+    sync_windows = 0;
+    start_period(RMS_WINDOW_INTS, 1);
+    edge_sync = 1;
+    start_edges();
+}
+
+
+static bit rms_poll()
+{
+    uint32 count, count_sq, sum_sq, mean_sq, variance;
+    uint16 sum_sq_hi, rms;
+    int32  deviation;
+
+    EA = 0;                         // sync_state is shared with both timer ISRs
+    if (sync_state == SYNC_ARMED && sync_windows > 0)
+    {
+        // No edge for a whole window, the input is DC or too slow, time the window instead
+        adc_window_reset = 1;
+        adc_window_open  = 1;
+        sync_state   = SYNC_TIMED;
+        sync_windows = 0;
+        period_count = 0;
+    }
+    else if ((sync_state == SYNC_TIMED && sync_windows > 0) ||
+             (sync_state == SYNC_OPEN && sync_windows > RECIP_TIMEOUT))
+    {
+        // End of a timed window, or the edges stopped while the window was open
+        adc_window_open = 0;
+        sync_state = SYNC_CLOSED;
+    }
+    EA = 1;
+
+    if (sync_state != SYNC_CLOSED)
+    {
+        return 0;
+    }
+    edge_sync = 0;
+    ET2 = 0;
+
+    // The window is closed so the adc ISR leaves the sums alone
+    count     = adc_sum_count;
+    deviation = adc_dev_sum;
+    sum_sq    = adc_sq_lo;
+    sum_sq_hi = adc_sq_hi;
+
+    if (count == 0)
+    {
+        meas_value = 0;
+        return 1;
+    }
+
+    // Shift the 48-bit sum of squares and its count down together until it fits 32 bits
+    count_sq = count;
+    while (sum_sq_hi != 0)
+    {
+        sum_sq = (sum_sq >> 1) | ((uint32) (sum_sq_hi & 1) << 31);
+        sum_sq_hi >>= 1;
+        count_sq >>= 1;
+    }
+    mean_sq = sum_sq / count_sq;
+
+    // Mean deviation from adc_ref, rounded
+    if (deviation < 0)
+    {
+        deviation = -(int32) ((-deviation + (count >> 1)) / count);
+    }
+    else
+    {
+        deviation = (deviation + (count >> 1)) / count;
+    }
+
+    // Variance is the mean square less the square of the mean, it is the AC part only
+    variance = (uint32) (deviation * deviation);
+    variance = mean_sq > variance ? mean_sq - variance : 0;
+
+    // Take the next deviations from this mean so the squares stay small
+    adc_ref += (int16) deviation;
+
+    // Root of variance * 256 is the RMS in 1/16 counts
+    rms = isqrt(variance << 8);
+
+    // Same factor of 2 from the circuit as the peak to peak, and back from 1/16 counts
+    meas_value = (adc_span_to_mV(rms) + 4) >> 3;
+    return 1;
+}
+
+
+// Scan mode converts every channel in scan_channels in turn and keeps a filtered
+// result of each in the adc table, a reading is just the next channel's entry.
+static void scan_start()
+{
+    // Only the first reading sets up, after that the interval repeats by itself
+    if (period_running)
+    {
+        return;
+    }
+
+    adc_scan_start(scan_channels, sizeof(scan_channels));
+    scan_index = 0;
+    start_period(SCAN_SHOW_INTS, 1);
+}
+
+
+static bit scan_poll()
+{
+    if (!period_over)
+    {
+        return 0;
+    }
+    period_over = 0;
+
+    scan_channel = scan_channels[scan_index];
+    if (++scan_index == sizeof(scan_channels))
+    {
+        scan_index = 0;
+    }
+
+    meas_value = adc_scan_mV(scan_channel);
+    return 1;
+}
+
+
+// Capture mode records the amplitude channel at the full conversion rate around a trigger
+// and sends the trace over the UART. A reading is the peak to peak of the trace.
+static void capture_start()
+{
+    adc_capture_start(amp_block, AMP_CHANNEL, CAPTURE_LEVEL, CAPTURE_EDGE, CAPTURE_PRE);
+    start_period(CAPTURE_AUTO_INTS, 0);
+}
+
+
+static bit capture_poll()
+{
+    uint16 min = 0xFFFF, max = 0;
+
+    // A trace is taken at most once a period so the last one has gone out before the next
+    if (!adc_capture_done())
+    {
+        if (period_over)
+        {
+            adc_capture_force();    // no edge, take what is there like a scope on auto
+        }
+        return 0;
+    }
+    if (!period_over)
+    {
+        return 0;
+    }
+    period_over = 0;
+    period_running = 0;
+
+    telemetry_trace(amp_block, adc_capture_first(), CAPTURE_PRE, AMP_CHANNEL);
+
+    // Same factor of 2 from the circuit as the amplitude mode
+    adc_block_minmax(amp_block, ADC_CAPTURE_SIZE, &min, &max);
+    meas_value = adc_span_to_mV(2 * (max - min));
+    return 1;
+}
+
+
+// Starts a new reading in a mode, anything still running is abandoned
+void measurement_start(uint8 mode)
+{
+    // Stop whatever the previous mode left running
+    if (mode != meas_mode)
+    {
+        ET0 = 0;
+        period_running = 0;
+        period_repeat = 0;
+        dc_latch = 0;
+        edge_sync = 0;
+        ET0 = 1;
+        period_over = 0;
+        ET2 = 0;
+        TR2 = 0;
+        amp_sync = 0;
+        ets_running = 0;
+        PT2 = 0;
+        CNT2 = 1;
+        gate_step = 0;              // the first frequency reading comes after the shortest gate
+        adc_stop();
+        meas_value = 0;             // the last reading was in the units of the old mode
+        meas_digits = 0;
+    }
+
+    meas_mode  = mode;
+    meas_state = MEAS_RUNNING;
+
+    switch (mode)
+    {
+        case DC_MODE:
+            dc_start();
+            break;
+
+        case FREQ_MODE:
+            frequency_start();
+            break;
+
+        case AMP_MODE:
+            amplitude_start();
+            break;
 
-    // Select adc channel 0
-    ADCCON2 = 0x02;
+        case RMS_MODE:
+            rms_start();
+            break;
 
-    adc_value = get_adc_value(10);
+        case SCAN_MODE:
+            scan_start();
+            break;
 
-	  // Convert raw value to mV
-	  mv = adc_value * 2500L/4096L;
-    return (uint16) mv;
+        case CAPTURE_MODE:
+            capture_start();
+            break;
+
+        default: // nothing to measure
+            meas_state = MEAS_IDLE;
+            break;
+    }
+}
+
+
+// Does a short slice of work on the running task, returns 1 when a new reading is ready
+bit measurement_poll()
+{
+    bit done = 0;
+
+    if (meas_state == MEAS_IDLE || meas_state == MEAS_DONE)
+    {
+        return 0;
+    }
+
+    switch (meas_mode)
+    {
+        case DC_MODE:
+            done = dc_poll();
+            break;
+
+        case FREQ_MODE:
+            done = frequency_poll();
+            break;
+
+        case AMP_MODE:
+            done = amplitude_poll();
+            break;
+
+        case RMS_MODE:
+            done = rms_poll();
+            break;
+
+        case SCAN_MODE:
+            done = scan_poll();
+            break;
+
+        case CAPTURE_MODE:
+            done = capture_poll();
+            break;
+    }
+
+    if (done)
+    {
+        meas_state = MEAS_DONE;
+    }
+    return done;
+}
+
+
+// Latest completed reading, mV or 0.01 Hz in frequency mode
+uint32 measurement_value()
+{
+    return meas_value;
+}
+
+
+// Significant digits of the latest frequency reading, 0 when all of them are
+uint8 measurement_digits()
+{
+    return meas_digits;
+}
+
+
+// Adc channel the latest scan mode reading was taken from
+uint8 measurement_channel()
+{
+    return scan_channel;
 }
@@ -2,17 +2,128 @@
 #define FREQUENCY_MODE_H
 
 #include "typedef.h"
+#include "config.h"
+#include "adc_interactions.h"
 
 typedef enum{
 	DC_MODE 	= 0x01,
 	FREQ_MODE = 0x02,
 	AMP_MODE 	= 0x04,
+	RMS_MODE 	= 0x08,
+	SCAN_MODE	= 0x10,
+	CAPTURE_MODE = 0x20,
 } MODE;
 
+// ADC channels used by the measurements
+#define DC_CHANNEL	0x02
+#define AMP_CHANNEL	0x01
+
+// The periods below are in timer 0 interrupts, MS_INTS() of config.h converts from ms.
+// Scan mode shows each scanned channel in turn for this many interrupts
+#ifndef SCAN_SHOW_INTS
+#define SCAN_SHOW_INTS	MS_INTS(1000)
+#endif
+
+// DC readings per second is set by the interval
+#ifndef DC_INTERVAL_INTS
+#define DC_INTERVAL_INTS	MS_INTS(100)
+#endif
+
+// Shortest RMS window, it is stretched to the next schmitt edge so it holds whole periods
+#ifndef RMS_WINDOW_INTS
+#define RMS_WINDOW_INTS		MS_INTS(100)
+#endif
+
+// Amplitude block capture, both can be overridden on the compiler command line
+#ifndef AMP_BLOCK_SIZE
+#define AMP_BLOCK_SIZE	256		// samples per DMA block, uses 2*(AMP_BLOCK_SIZE+1) bytes of xdata
+#endif
+#ifndef AMP_WINDOW_INTS
+#define AMP_WINDOW_INTS	MS_INTS(1000)	// the peak is measured over this long without edges
+#endif
+
+// With edges on the schmitt input the peak is measured over whole periods instead. Timer 2
+// counts amp_periods edges per window, doubled or halved after each window so the next one
+// lasts at least AMP_MIN_WINDOW_INTS. 0 always uses the fixed DMA window, for comparison.
+#ifndef AMP_EDGE_SYNC
+#define AMP_EDGE_SYNC		1
+#endif
+#ifndef AMP_MIN_WINDOW_INTS
+#define AMP_MIN_WINDOW_INTS	MS_INTS(10)	// enough conversions to land near both peaks
+#endif
+#define AMP_MIN_PERIODS		1
+#define AMP_MAX_PERIODS		4096	// 20 kHz fills the minimum window with ~200
+
+// Equivalent time sampling takes over from the windows when a period is shorter than
+// ETS_CONVERSIONS conversions. Each schmitt edge starts a timer 2 delay and its overflow
+// starts one conversion, the delay growing by 1/ETS_POINTS of a period every time, so
+// ETS_POINTS conversions over as many periods make up one period of a repetitive input.
+#ifndef AMP_ETS
+#define AMP_ETS				1
+#endif
+#ifndef ETS_CONVERSIONS
+#define ETS_CONVERSIONS		32		// above ~2.2 kHz at ADC_PEAK_CYCLES
+#endif
+#define ETS_POINTS			ADC_CAPTURE_SIZE	// one trace
+#define ETS_MIN_DELAY		16		// core cycles, timer 2 is never loaded with a delay of 0
+
+// Capture mode, a trace of ADC_CAPTURE_SIZE samples around each trigger on the amplitude channel
+#ifndef CAPTURE_LEVEL_MV
+#define CAPTURE_LEVEL_MV	1250	// trigger level
+#endif
+#ifndef CAPTURE_EDGE
+#define CAPTURE_EDGE		ADC_EDGE_RISING
+#endif
+#ifndef CAPTURE_PRE
+#define CAPTURE_PRE			64		// samples kept from before the trigger
+#endif
+#ifndef CAPTURE_AUTO_INTS
+#define CAPTURE_AUTO_INTS	MS_INTS(500)	// a trace every 0.5 s, forced if there is no trigger by then
+#endif
+#define CAPTURE_LEVEL		((uint16) ((uint32) CAPTURE_LEVEL_MV * ADC_COUNTS / ADC_VREF_MV))
+
+#if AMP_BLOCK_SIZE < ADC_CAPTURE_SIZE
+#error "capture mode records into the amplitude block, it must hold a whole ring"
+#endif
+#if SCAN_SHOW_INTS > 65535 || DC_INTERVAL_INTS > 65535 || RMS_WINDOW_INTS > 65535 || \
+	AMP_WINDOW_INTS > 65535 || CAPTURE_AUTO_INTS > 65535
+#error "a measurement period is longer than the 16 bit period counter can time"
+#endif
+
+// Frequency mode counts the edges over a gate of GATE_MS to GATE_MS << GATE_MAX_STEP, set in
+// config.h. Below RECIP_MAX_HZ every edge interrupts and the first and last are timed instead,
+// which resolves a core cycle on the shortest gate. It is where the longest gate counts
+// GATE_EDGES, 12.5 kHz by default, so no input waits longer for fewer digits. The timed
+// edges cost an interrupt each, so it is held to RECIP_LIMIT_HZ, and above that a fixed
+// or short longest gate counts fewer edges and shows fewer digits.
+#define TIMER_CLOCK		F_OSC		// timer 1 counts once per core clock
+#define RECIP_LIMIT_HZ	20000L		// timer 2 interrupts a second the timed edges may cost
+#if GATE_EDGES * 1000 / (GATE_MS << GATE_MAX_STEP) < RECIP_LIMIT_HZ
+#define RECIP_MAX_HZ	(GATE_EDGES * 1000 / (GATE_MS << GATE_MAX_STEP))
+#else
+#define RECIP_MAX_HZ	RECIP_LIMIT_HZ
+#endif
+#define RECIP_MAX_EDGES	(RECIP_MAX_HZ * GATE_MS / 1000)	// edges per shortest gate
+#define RECIP_WAIT_GATES	((4000 + GATE_MS - 1) / GATE_MS)	// extra gates to wait for a second edge,
+																// two edges of 0.5 Hz take up to 4 s
+#define RECIP_TIMEOUT	3			// windows to wait for the closing edge in amplitude and RMS modes
+
+#if RECIP_MAX_EDGES < 2
+#error "GATE_MS is too short for two edges at RECIP_MAX_HZ, the reciprocal reading needs them"
+#endif
+
+extern uint16 timer1_overflows;		// upper 16 bits of the timer 1 timestamp, counted by its ISR
+
 void setup_frequency_timers();
 
-uint16 get_frequency_value();
-uint16 get_amplitiude_value();
-uint16 get_mDC_value();
+// Measurement tasks, driven from the main loop
+bit scheduler_tick();				// returns 1 every ~10 ms scheduler tick
+uint32 scheduler_time();			// scheduler ticks since reset
+void measurement_start(uint8 mode);	// starts a reading, abandons any running one
+bit measurement_poll();				// does a slice of work, returns 1 when a reading is ready
+uint32 measurement_value();			// latest reading, mV or 0.01 Hz in frequency mode
+uint8 measurement_digits();			// significant digits of the latest reading, 0 for all shown
+uint8 measurement_channel();		// adc channel of the latest reading in scan mode
+uint16 isqrt(uint32 value);			// integer square root, rounded down
 
 #endif
@@ -0,0 +1,80 @@
+#include "hal.h"
+#include "typedef.h"
+#include "profile.h"
+#include "uart.h"
+
+#ifdef PROFILE
+
+PROF_PROBE xdata prof_table[PROF_PROBES];
+
+static char code * code prof_names[PROF_PROBES] = {"timer0", "timer2", "get_adc_value", "display", "adc_isr"};
+
+
+static void prof_clear()
+{
+	uint8 i;
+
+	for(i = 0; i < PROF_PROBES; i++)
+	{
+		EA = 0;
+		prof_table[i].min   = 0xFFFF;
+		prof_table[i].max   = 0;
+		prof_table[i].count = 0;
+		prof_table[i].sum   = 0;
+		prof_table[i].skip  = 0;
+		EA = 1;
+	}
+}
+
+
+// Prints probe,count,min_cycles,mean_cycles,max_cycles for every probe
+static void prof_dump()
+{
+	PROF_PROBE probe;
+	uint8 i;
+
+	uart_puts("probe,count,min_cycles,mean_cycles,max_cycles\r\n");
+	for(i = 0; i < PROF_PROBES; i++)
+	{
+		EA = 0;		// the ISR probes update their entries at any time
+		probe = prof_table[i];
+		EA = 1;
+
+		uart_puts(prof_names[i]);
+		uart_putc(',');
+		uart_put_uint(probe.count);
+		uart_putc(',');
+		uart_put_uint(probe.count ? probe.min : 0);
+		uart_putc(',');
+		uart_put_uint(probe.count ? (probe.sum + probe.count / 2) / probe.count : 0);
+		uart_putc(',');
+		uart_put_uint(probe.max);
+		uart_puts("\r\n");
+	}
+}
+
+
+void prof_setup()
+{
+	prof_clear();
+#ifdef PROF_PIN_ID
+	PROF_PIN = 0;
+#endif
+}
+
+
+void prof_command(char c)
+{
+	switch(c)
+	{
+		case 'p':
+			prof_dump();
+			break;
+
+		case 'r':
+			prof_clear();
+			break;
+	}
+}
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "typedef.h"
+#include "hal.h"
+
+// Entry and exit timing of the hot paths, built in when PROFILE is defined on the compiler
+// command line and compiled out completely otherwise. Each probe keeps the min, max and
+// mean cycles between PROF_ENTER and PROF_EXIT, read from the free running timer 1. The
+// table is in xdata, it does not fit the internal RAM, and only the store of the entry time
+// falls inside a timing. Send 'p' on the UART for the table, 'r' to clear it.
+//
+// Defining PROF_PIN_ID as one of the probes also drives the spare pin P3.4 high between
+// its entry and exit, for triggering a scope. Timings must stay under 65536 cycles.
+//
+// A probe on code that runs more often than its own timing can afford uses PROF_ENTER_EVERY
+// and PROF_EXIT_EVERY instead, and only every nth run is timed.
+//
+// Everything is done inline in the macros, a shared function would not be reentrant
+// between the ISRs and the main loop on the 8051.
+
+#define PROF_TIMER0		0	// timer 0 ISR
+#define PROF_TIMER2		1	// timer 2 ISR
+#define PROF_ADC_VALUE	2	// get_adc_value()
+#define PROF_DISPLAY	3	// display()
+#define PROF_ADC_ISR	4	// adc ISR, timed every PROF_ADC_EVERY runs
+#define PROF_PROBES		5
+
+// The adc ISR runs every 160 or 640 cycles, and a probe adds ~40 of its own to each run it times
+#define PROF_ADC_EVERY	64
+
+#ifdef PROFILE
+
+typedef struct {
+	uint16 start;	// timer 1 at the last entry
+	uint16 min;
+	uint16 max;
+	uint16 count;
+	uint32 sum;
+	uint8  skip;	// runs since the last timed one, PROF_ENTER_EVERY only
+} PROF_PROBE;
+
+extern PROF_PROBE xdata prof_table[PROF_PROBES];
+
+// Reads the 16-bit timer 1, again if TL1 rolled over between the two reads
+#define PROF_NOW(t) \
+	{ \
+		uint8 high_ = TH1; \
+		uint8 low_  = TL1; \
+		if(high_ != TH1) \
+		{ \
+			high_ = TH1; \
+			low_  = TL1; \
+		} \
+		(t) = ((uint16) high_ << 8) | low_; \
+	}
+
+#ifdef PROF_PIN_ID
+#define PROF_PIN_SET(id, level)	{ if((id) == PROF_PIN_ID) PROF_PIN = (level); }
+#else
+#define PROF_PIN_SET(id, level)
+#endif
+
+#define PROF_ENTER(id) \
+	{ \
+		PROF_PIN_SET(id, 1); \
+		PROF_NOW(prof_table[id].start); \
+	}
+
+// The count stops at 0xFFFF so the mean stays right
+#define PROF_EXIT(id) \
+	{ \
+		uint16 cycles_; \
+		PROF_NOW(cycles_); \
+		PROF_PIN_SET(id, 0); \
+		cycles_ -= prof_table[id].start; \
+		if(prof_table[id].count != 0xFFFF) \
+		{ \
+			if(cycles_ < prof_table[id].min) prof_table[id].min = cycles_; \
+			if(cycles_ > prof_table[id].max) prof_table[id].max = cycles_; \
+			prof_table[id].sum += cycles_; \
+			prof_table[id].count++; \
+		} \
+	}
+
+// The skip count is back at 0 only in a run that was timed
+#define PROF_ENTER_EVERY(id, n) \
+	{ \
+		if(++prof_table[id].skip == (n)) \
+		{ \
+			prof_table[id].skip = 0; \
+			PROF_ENTER(id); \
+		} \
+	}
+
+#define PROF_EXIT_EVERY(id) \
+	{ \
+		if(prof_table[id].skip == 0) \
+		{ \
+			PROF_EXIT(id); \
+		} \
+	}
+
+void prof_setup();
+void prof_command(char c);	// 'p' prints the table, 'r' clears it
+
+#define PROF_SETUP()		prof_setup()
+#define PROF_COMMAND(c)		prof_command(c)
+
+#else
+
+#define PROF_ENTER(id)
+#define PROF_EXIT(id)
+#define PROF_ENTER_EVERY(id, n)
+#define PROF_EXIT_EVERY(id)
+#define PROF_SETUP()
+#define PROF_COMMAND(c)
+
+#endif
+
+#endif
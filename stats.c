@@ -0,0 +1,348 @@
+#include "hal.h"
+#include "typedef.h"
+#include "stats.h"
+#include "measurements.h"
+#include "uart.h"
+
+STATS xdata stats_table[STATS_MODES];
+uint32 xdata stats_held;	// reading frozen by STATS_HOLD
+uint8 xdata stats_last_view;	// view at the previous stats_value()
+
+static char code * code stats_names[STATS_MODES] = {"dc", "freq", "amp", "rms", "scan", "capture"};
+
+
+// Entry of a mode, 0 for modes without statistics
+static STATS xdata *stats_entry(uint8 mode)
+{
+	uint8 i;
+
+	for(i = 0; i < STATS_MODES; i++)
+	{
+		if(mode == (1 << i))
+		{
+			return &stats_table[i];
+		}
+	}
+	return 0;
+}
+
+
+// rest / n in 1/256, rounded. Both are shifted down together until rest * 256 fits.
+static uint16 stats_fraction(uint32 rest, uint32 n)
+{
+	while(n >= 0x800000L)
+	{
+		rest >>= 1;
+		n >>= 1;
+	}
+	return ((rest << 8) + (n >> 1)) / n;
+}
+
+
+// whole - fraction / 256 as a mantissa of at most 16 bits and the shift that scales it back
+// to 1/256 units. Far from the mean the fraction makes no difference and is left out.
+static int32 stats_dev(int32 whole, uint16 fraction, uint8 *shift)
+{
+	int32 deviation;
+	uint32 magnitude;
+
+	*shift = 0;
+	if(whole < 0x400000L && whole > -0x400000L)
+	{
+		deviation = (whole << 8) - fraction;
+	}
+	else
+	{
+		deviation = whole;
+		*shift = 8;
+	}
+
+	magnitude = deviation < 0 ? -deviation : deviation;
+	while(magnitude >= 0x10000L)
+	{
+		magnitude = (magnitude >> 1) + (magnitude & 1);
+		(*shift)++;
+	}
+	return deviation < 0 ? -(int32) magnitude : (int32) magnitude;
+}
+
+
+// Adds term << shift to the block floating m2. A term below the scale of the sum is rounded
+// to it, one above moves the sum up, and a carry out of 32 bits halves the sum.
+static void stats_add(STATS xdata *s, uint32 term, uint8 shift)
+{
+	uint8 below;
+
+	if(shift < s->m2_shift)
+	{
+		below = s->m2_shift - shift;
+		if(below > 32)
+		{
+			return;
+		}
+		term >>= below - 1;						// in two steps, a shift of 32 is undefined
+		term = (term >> 1) + (term & 1);
+	}
+	while(shift > s->m2_shift)
+	{
+		if(term < 0x80000000L)
+		{
+			term <<= 1;
+			shift--;
+		}
+		else
+		{
+			s->m2 = (s->m2 >> 1) + (s->m2 & 1);
+			s->m2_shift++;
+		}
+	}
+
+	s->m2 += term;
+	if(s->m2 < term)
+	{
+		s->m2 = (s->m2 >> 1) | 0x80000000L;
+		s->m2_shift++;
+	}
+}
+
+
+void stats_clear()
+{
+	uint8 i;
+
+	for(i = 0; i < STATS_MODES; i++)
+	{
+		stats_table[i].count = 0;
+		stats_table[i].n = 0;
+	}
+	stats_last_view = STATS_LIVE;
+}
+
+
+void stats_update(uint8 mode, uint32 value)
+{
+	STATS xdata *s = stats_entry(mode);
+	int32 whole, rest, step, before, after;
+	uint8 before_shift, after_shift;
+
+	if(s == 0)
+	{
+		return;
+	}
+
+	if(s->count == 0)
+	{
+		s->min = value;
+		s->max = value;
+	}
+	if(value < s->min) s->min = value;
+	if(value > s->max) s->max = value;
+	if(s->count != 0xFFFFFFFF)
+	{
+		s->count++;
+	}
+
+	if(s->n == 0)
+	{
+		s->n = 1;
+		s->mean = value;
+		s->rest = 0;
+		s->m2 = 0;
+		s->m2_shift = 0;
+		return;
+	}
+	if(s->n >= STATS_COUNT_MAX)
+	{
+		return;
+	}
+
+	// Deviation from the mean before it takes this reading
+	whole = (int32) (value - s->mean);
+	before = stats_dev(whole, stats_fraction(s->rest, s->n), &before_shift);
+
+	// The readings add up to n * mean + rest, so one more adds its deviation to the rest.
+	// Below 2^30 each, the sum fits an int32. Whole means move out of it, the rest stays
+	// from 0 to n - 1 so the mean is exact.
+	s->n++;
+	rest = (int32) s->rest + whole;
+	step = rest / (int32) s->n;
+	rest -= step * (int32) s->n;
+	if(rest < 0)
+	{
+		rest += s->n;
+		step--;
+	}
+	s->mean += step;
+	s->rest = rest;
+
+	// and after, the two have the same sign unless one rounded to 0
+	whole = (int32) (value - s->mean);
+	after = stats_dev(whole, stats_fraction(s->rest, s->n), &after_shift);
+	if((before < 0) == (after < 0))
+	{
+		if(before < 0)
+		{
+			before = -before;
+			after = -after;
+		}
+		stats_add(s, (uint32) before * (uint32) after, before_shift + after_shift);
+	}
+}
+
+
+uint32 stats_value(uint8 mode, uint8 view, uint32 live)
+{
+	STATS xdata *s = stats_entry(mode);
+
+	if(view == STATS_HOLD && stats_last_view != STATS_HOLD)
+	{
+		stats_held = live;
+	}
+	stats_last_view = view;
+
+	if(view == STATS_HOLD)
+	{
+		return stats_held;
+	}
+	if(s == 0 || s->count == 0)
+	{
+		return live;
+	}
+	if(view == STATS_MIN)
+	{
+		return s->min;
+	}
+	if(view == STATS_MAX)
+	{
+		return s->max;
+	}
+	return live;
+}
+
+
+uint32 stats_mean(uint8 mode)
+{
+	STATS xdata *s = stats_entry(mode);
+
+	if(s == 0 || s->n == 0)
+	{
+		return 0;
+	}
+	return s->mean + (s->rest >= s->n - s->rest);	// rounded, rest / n >= 1/2
+}
+
+
+// Root of m2 << m2_shift / n in 1/16 units. The quotient is worked out to 31 bits by long
+// division, so the root has 16 whatever the spread.
+uint32 stats_deviation(uint8 mode)
+{
+	STATS xdata *s = stats_entry(mode);
+	uint32 quotient, rest, n;
+	uint16 root;
+	int8 shift;
+
+	if(s == 0 || s->n == 0 || s->m2 == 0)
+	{
+		return 0;
+	}
+
+	// m2 is in 1/65536 units^2, the root of 1/256 units^2 is 1/16 units
+	quotient = s->m2;
+	shift = (int8) s->m2_shift - 8;
+	while(quotient < 0x80000000L)
+	{
+		quotient <<= 1;
+		shift--;
+	}
+	n = s->n;
+	rest = quotient % n;
+	quotient /= n;
+	while(quotient < 0x40000000L)
+	{
+		rest <<= 1;
+		quotient <<= 1;
+		if(rest >= n)
+		{
+			rest -= n;
+			quotient |= 1;
+		}
+		shift--;
+	}
+	if(shift & 1)
+	{
+		quotient <<= 1;
+		shift--;
+	}
+
+	root = isqrt(quotient);
+	shift /= 2;
+	if(shift > 16)
+	{
+		return 0xFFFFFFFF;
+	}
+	if(shift >= 0)
+	{
+		return (uint32) root << shift;
+	}
+	if(shift < -16)
+	{
+		return 0;
+	}
+	return ((uint32) root + (1L << (-shift - 1))) >> -shift;
+}
+
+
+// Prints mode,count,min,max,mean,stddev for every mode with readings, stddev to 0.1 units
+static void stats_dump()
+{
+	uint8 i, mode, tenths;
+	uint32 deviation;
+
+	uart_puts("mode,count,min,max,mean,stddev\r\n");
+	for(i = 0; i < STATS_MODES; i++)
+	{
+		if(stats_table[i].count == 0)
+		{
+			continue;
+		}
+		mode = 1 << i;
+		deviation = stats_deviation(mode);
+		tenths = ((deviation & 15) * 10 + 8) >> 4;
+		deviation >>= 4;
+		if(tenths == 10)
+		{
+			deviation++;
+			tenths = 0;
+		}
+
+		uart_puts(stats_names[i]);
+		uart_putc(',');
+		uart_put_uint(stats_table[i].count);
+		uart_putc(',');
+		uart_put_uint(stats_table[i].min);
+		uart_putc(',');
+		uart_put_uint(stats_table[i].max);
+		uart_putc(',');
+		uart_put_uint(stats_mean(mode));
+		uart_putc(',');
+		uart_put_uint(deviation);
+		uart_putc('.');
+		uart_putc('0' + tenths);
+		uart_puts("\r\n");
+	}
+}
+
+
+void stats_command(char c)
+{
+	switch(c)
+	{
+		case 's':
+			stats_dump();
+			break;
+
+		case 'c':
+			stats_clear();
+			break;
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "typedef.h"
+#include "hal.h"
+
+// Running statistics of the readings of each mode: min, max, mean and variance over every
+// reading since they were cleared. Every update is O(1) with no allocation.
+//
+// The mean is kept exactly as a whole part and a remainder over n, so it never drifts and
+// never turns into an average of the latest readings. The variance is Welford's sum
+//
+//   m2 += (x - mean_before) * (x - mean_after)
+//
+// with the deviations to 1/256 of a unit, in a block floating sum: a 32 bit mantissa and a
+// shift that grows when it overflows, so neither small nor large spreads are clipped.
+// Readings must stay below 2^30, 10 MHz in 0.01 Hz, and after STATS_COUNT_MAX of them the
+// mean and variance stop taking more. Send 's' on the UART for the table, 'c' to clear it.
+
+#define STATS_COUNT_MAX	0x3FFFFFFFL	// readings in the mean and variance, 3 years at 10 a second
+
+// Views of the statistics selected by P2.6 and P2.7
+#define STATS_VIEW_MASK	0xC0
+#define STATS_LIVE		0x00		// latest reading
+#define STATS_MIN		0x40		// P2.6, lowest reading
+#define STATS_MAX		0x80		// P2.7, highest reading
+#define STATS_HOLD		0xC0		// both, the reading when the switches were set
+
+#define STATS_MODES		6			// one entry per mode bit
+
+typedef struct {
+	uint32 count;		// readings since cleared, saturates
+	uint32 min;
+	uint32 max;
+	uint32 n;			// readings in the mean and variance, up to STATS_COUNT_MAX
+	uint32 mean;		// whole part of the mean
+	uint32 rest;		// the mean is mean + rest / n, rest below n
+	uint32 m2;			// sum of squared deviations, m2 << m2_shift in 1/65536 units^2
+	uint8  m2_shift;
+} STATS;
+
+void stats_clear();
+void stats_update(uint8 mode, uint32 value);	// adds a reading of a mode
+uint32 stats_value(uint8 mode, uint8 view, uint32 live); // value shown in a view
+uint32 stats_mean(uint8 mode);		// mean reading, rounded
+uint32 stats_deviation(uint8 mode);	// standard deviation in 1/16 units
+void stats_command(char c);			// 's' prints the table, 'c' clears it
+
+#endif
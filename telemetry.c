@@ -0,0 +1,196 @@
+#include "hal.h"
+#include "typedef.h"
+#include "telemetry.h"
+#include "uart.h"
+#include "measurements.h"
+
+bit    telemetry_readings;
+bit    telemetry_blocks;
+uint16 xdata telemetry_dropped;
+
+// Copy of the last amplitude block, sent a frame at a time while the UART is idle
+uint16 xdata telemetry_block_copy[TELEM_BLOCK_SAMPLES];
+uint16 xdata block_size;	// samples in the copy
+uint16 xdata block_left;	// samples still to send, 0 once the copy can be refilled
+uint8 xdata block_channel;
+uint8 xdata block_number;	// counts copied blocks, so the decoder can tell them apart
+uint8 xdata block_type;		// TELEM_BLOCK or TELEM_TRACE
+uint16 xdata block_trigger;	// index of the trigger sample in a trace
+
+
+// Writes the header of a frame and returns where the payload goes
+static uint8 xdata *frame_start(uint8 xdata *frame, uint8 type, uint8 length)
+{
+	uint32 time = scheduler_time();
+
+	frame[0] = TELEM_SYNC_0;
+	frame[1] = TELEM_SYNC_1;
+	frame[2] = type;
+	frame[3] = length;
+	frame[4] = time >> 24;
+	frame[5] = time >> 16;
+	frame[6] = time >> 8;
+	frame[7] = time;
+	return frame + TELEM_HEADER;
+}
+
+
+// Adds the checksum and queues the frame
+static void frame_send(uint8 xdata *frame)
+{
+	uint8 length = TELEM_HEADER + frame[3];
+	uint8 sum = 0;
+	uint8 i;
+
+	for(i = 2; i < length; i++)
+	{
+		sum += frame[i];
+	}
+	frame[length] = -sum;
+	uart_queue(frame, length + 1);
+}
+
+
+void telemetry_setup()
+{
+	telemetry_readings = 0;
+	telemetry_blocks = 0;
+	telemetry_dropped = 0;
+	block_left = 0;
+	block_number = 0;
+}
+
+
+void telemetry_reading(uint8 mode, uint32 value)
+{
+	uint8 xdata *frame;
+	uint8 xdata *payload;
+
+	if(!telemetry_readings)
+	{
+		return;
+	}
+	frame = uart_claim();
+	if(frame == 0)
+	{
+		telemetry_dropped++;
+		return;
+	}
+
+	payload = frame_start(frame, TELEM_READING, 5);
+	payload[0] = mode;
+	payload[1] = value >> 24;
+	payload[2] = value >> 16;
+	payload[3] = value >> 8;
+	payload[4] = value;
+	frame_send(frame);
+}
+
+
+// Takes a copy of a block if the last one has gone, blocks in between are skipped
+void telemetry_block(uint16 xdata *block, uint16 num_samples, uint8 channel)
+{
+	uint16 i;
+
+	if(!telemetry_blocks || block_left != 0)
+	{
+		return;
+	}
+	if(num_samples > TELEM_BLOCK_SAMPLES)
+	{
+		num_samples = TELEM_BLOCK_SAMPLES;
+	}
+
+	for(i = 0; i < num_samples; i++)
+	{
+		telemetry_block_copy[i] = block[i] & 0x0FFF;	// strip the channel id
+	}
+	block_size = num_samples;
+	block_left = num_samples;
+	block_channel = channel;
+	block_type = TELEM_BLOCK;
+	block_number++;
+}
+
+
+// Takes a copy of a capture in time order if the last block or trace has gone. Capture mode
+// traces are sent whether or not raw blocks are on, amplitude mode only sends its equivalent
+// time traces with them.
+void telemetry_trace(uint16 xdata *ring, uint16 first, uint16 trigger, uint8 channel)
+{
+	uint16 i;
+
+	if(block_left != 0)
+	{
+		return;
+	}
+
+	for(i = 0; i < ADC_CAPTURE_SIZE; i++)
+	{
+		telemetry_block_copy[i] = ring[(first + i) & ADC_CAPTURE_MASK];
+	}
+	block_size = ADC_CAPTURE_SIZE;
+	block_left = ADC_CAPTURE_SIZE;
+	block_channel = channel;
+	block_type = TELEM_TRACE;
+	block_trigger = trigger;
+	block_number++;
+}
+
+
+// Block frames only go when the UART is idle, the other buffer stays free for readings
+void telemetry_poll()
+{
+	uint8 xdata *frame;
+	uint8 xdata *payload;
+	uint16 offset, sample;
+	uint8 n, i;
+
+	if(block_left == 0 || !uart_idle())
+	{
+		return;
+	}
+	frame = uart_claim();
+
+	n = block_left < TELEM_CHUNK_SAMPLES ? block_left : TELEM_CHUNK_SAMPLES;
+	offset = block_size - block_left;
+
+	payload = frame_start(frame, block_type, (block_type == TELEM_TRACE ? 8 : 6) + 2 * n);
+	payload[0] = block_channel;
+	payload[1] = block_number;
+	payload[2] = block_size >> 8;
+	payload[3] = block_size;
+	payload[4] = offset >> 8;
+	payload[5] = offset;
+	payload += 6;
+	if(block_type == TELEM_TRACE)
+	{
+		*payload++ = block_trigger >> 8;
+		*payload++ = block_trigger;
+	}
+	for(i = 0; i < n; i++)
+	{
+		sample = telemetry_block_copy[offset + i];
+		*payload++ = sample >> 8;
+		*payload++ = sample;
+	}
+	frame_send(frame);
+
+	block_left -= n;
+}
+
+
+void telemetry_command(char c)
+{
+	switch(c)
+	{
+		case 't':
+			telemetry_readings = !telemetry_readings;
+			break;
+
+		case 'b':
+			telemetry_blocks = !telemetry_blocks;
+			block_left = 0;
+			break;
+	}
+}
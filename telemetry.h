@@ -0,0 +1,53 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "typedef.h"
+#include "measurements.h"
+#include "uart.h"
+#include "adc_interactions.h"
+
+// Binary telemetry on the UART, decoded by tools/telemetry_decode.py.
+// Every frame is, multi-byte fields big endian:
+//
+//   0xA5 0x5A  type  length  time (4)  payload (length)  checksum
+//
+// time is in scheduler ticks of ~10 ms since reset, and the checksum makes the bytes from
+// type to the end of the payload sum to 0. Frames are only sent when a UART buffer is
+// free, otherwise they are counted in telemetry_dropped, so acquisition never waits.
+// Readings and blocks, with the equivalent time traces of amplitude mode, are off at reset
+// and turned on with 't' and 'b', so the text of the 's' and 'p' tables is not mixed with
+// frames unless asked for. Capture mode traces are its output and always go.
+
+#define TELEM_SYNC_0		0xA5
+#define TELEM_SYNC_1		0x5A
+#define TELEM_HEADER		8	// sync, type, length and time
+#define TELEM_READING		0x01	// payload: mode, value (4) in mV or 0.01 Hz
+#define TELEM_BLOCK			0x02	// payload: channel, block number, block size (2), offset (2),
+									// samples (2 each)
+#define TELEM_TRACE			0x03	// payload: as TELEM_BLOCK with the trigger index (2) before
+									// the samples, which are in time order. Equivalent time
+									// traces are one period from the edge, trigger index 0.
+
+// Raw amplitude samples sent per block, and per frame so a frame fits a UART buffer
+#define TELEM_BLOCK_SAMPLES	AMP_BLOCK_SIZE
+#define TELEM_CHUNK_SAMPLES	32
+
+#if TELEM_HEADER + 8 + 2 * TELEM_CHUNK_SAMPLES + 1 > UART_BUFFER_SIZE
+#error "a block or trace frame must fit a UART buffer"
+#endif
+#if TELEM_BLOCK_SAMPLES < ADC_CAPTURE_SIZE
+#error "a capture must fit the block copy"
+#endif
+
+extern bit    telemetry_readings;	// send a frame for every reading, off at reset
+extern bit    telemetry_blocks;		// send raw amplitude blocks, off at reset
+extern uint16 xdata telemetry_dropped;	// frames not sent because both buffers were busy
+
+void telemetry_setup();
+void telemetry_reading(uint8 mode, uint32 value);
+void telemetry_block(uint16 xdata *block, uint16 num_samples, uint8 channel);
+void telemetry_trace(uint16 xdata *ring, uint16 first, uint16 trigger, uint8 channel); // a capture ring
+void telemetry_poll();			// sends the next part of a block, call from the main loop
+void telemetry_command(char c);	// 't' toggles readings, 'b' toggles blocks
+
+#endif
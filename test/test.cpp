@@ -0,0 +1,286 @@
+// Runner for the tests in test/, see test.h
+//
+//   build/host/tests              every test
+//   build/host/tests adc ring     the tests with any of the words in their name
+
+#include <csetjmp>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "test/test.h"
+#include "config.h"
+
+#define MAX_REPORTS	10			// failed checks printed per test, the rest are only counted
+#define TIME_LIMIT	300			// seconds a test may take, a firmware wait that never ends fails it
+#define TICK_S		((double) TICK_INTS * TIMER0_CYCLES / F_OSC)	// telemetry time unit
+
+struct registered
+{
+	const char *name;
+	void (*fn)(void);
+};
+
+std::vector<uint8> test_uart;
+
+static std::vector<registered> &tests()
+{
+	static std::vector<registered> list;	// filled by static initialisers, so not a plain global
+	return list;
+}
+
+static int      failures;
+static const char *current;		// name of the running test
+static jmp_buf  run_end;
+
+void firmware_main(void);
+
+
+test_case::test_case(const char *name, void (*fn)(void))
+{
+	registered test = {name, fn};
+
+	tests().push_back(test);
+}
+
+
+static void report(const char *file, int line, const char *text)
+{
+	if (++failures == 1)
+	{
+		printf("%s:\n", current);
+	}
+	if (failures <= MAX_REPORTS)
+	{
+		printf("  %s:%d: %s\n", file, line, text);
+	}
+}
+
+
+bool test_check(bool ok, const char *text, const char *file, int line)
+{
+	char message[512];
+
+	if (!ok)
+	{
+		snprintf(message, sizeof(message), "CHECK(%s) failed", text);
+		report(file, line, message);
+	}
+	return ok;
+}
+
+
+bool test_check_equal(long long expected, long long actual, const char *text, const char *file, int line)
+{
+	char message[512];
+
+	if (expected != actual)
+	{
+		snprintf(message, sizeof(message), "%s is %lld, expected %lld", text, actual, expected);
+		report(file, line, message);
+	}
+	return expected == actual;
+}
+
+
+bool test_check_near(double expected, double actual, double tolerance, const char *text, const char *file,
+					 int line)
+{
+	char message[512];
+	bool ok = fabs(actual - expected) <= tolerance;
+
+	if (!ok)
+	{
+		snprintf(message, sizeof(message), "%s is %g, expected %g +- %g", text, actual, expected, tolerance);
+		report(file, line, message);
+	}
+	return ok;
+}
+
+
+bool test_check_text(const std::string &expected, const std::string &actual, const char *text, const char *file,
+					 int line)
+{
+	char message[512];
+
+	if (expected != actual)
+	{
+		snprintf(message, sizeof(message), "%s is \"%s\", expected \"%s\"", text, actual.c_str(), expected.c_str());
+		report(file, line, message);
+	}
+	return expected == actual;
+}
+
+
+static void uart_byte(uint8 byte)
+{
+	test_uart.push_back(byte);
+}
+
+
+static void run_ended()
+{
+	longjmp(run_end, 1);
+}
+
+
+static void ran_over()
+{
+	printf("  the firmware was called again after test_run() ended\n");
+	fflush(stdout);
+	_exit(1);
+}
+
+
+void test_sim(const char *options)
+{
+	static std::string text;
+	static std::vector<char *> argv;
+	char *word;
+
+	text = std::string("-q -t 1000 ") + options;
+	argv.assign(1, (char *) "tests");
+	for (word = strtok(&text[0], " "); word; word = strtok(0, " "))
+	{
+		argv.push_back(word);
+	}
+	argv.push_back(0);
+
+	sim_setup(argv.size() - 1, argv.data());
+	sim_uart_out = uart_byte;
+	sim_end = ran_over;
+}
+
+
+void test_run()
+{
+	sim_end = run_ended;
+	if (!setjmp(run_end))
+	{
+		firmware_main();
+	}
+	sim_end = ran_over;
+}
+
+
+std::vector<test_frame> test_frames()
+{
+	std::vector<test_frame> frames;
+	test_frame frame;
+	size_t i = 0, length, k;
+	uint8 sum;
+
+	while (i + 9 <= test_uart.size())
+	{
+		length = test_uart[i + 3];
+		if (test_uart[i] != 0xA5 || test_uart[i + 1] != 0x5A || i + 9 + length > test_uart.size())
+		{
+			i++;
+			continue;
+		}
+		for (sum = 0, k = i + 2; k < i + 9 + length; k++)
+		{
+			sum += test_uart[k];
+		}
+		if (sum)
+		{
+			i++;
+			continue;
+		}
+
+		frame.type = test_uart[i + 2];
+		frame.time = TICK_S * ((uint32_t) test_uart[i + 4] << 24 | test_uart[i + 5] << 16 |
+							   test_uart[i + 6] << 8 | test_uart[i + 7]);
+		frame.payload.assign(test_uart.begin() + i + 8, test_uart.begin() + i + 8 + length);
+		frames.push_back(frame);
+		i += 9 + length;
+	}
+	return frames;
+}
+
+
+std::vector<std::pair<double, uint32_t> > test_readings(uint8 mode)
+{
+	std::vector<std::pair<double, uint32_t> > readings;
+
+	for (const test_frame &frame : test_frames())
+	{
+		if (frame.type == 0x01 && frame.payload.size() == 5 && frame.payload[0] == mode)
+		{
+			readings.push_back(std::make_pair(frame.time, (uint32_t) frame.payload[1] << 24 |
+											  frame.payload[2] << 16 | frame.payload[3] << 8 | frame.payload[4]));
+		}
+	}
+	return readings;
+}
+
+
+static bool selected(const char *name, int argc, char **argv)
+{
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strstr(name, argv[i]))
+		{
+			return true;
+		}
+	}
+	return argc < 2;
+}
+
+
+int main(int argc, char **argv)
+{
+	std::chrono::steady_clock::time_point start;
+	int run = 0, failed = 0, status;
+	pid_t child;
+
+	for (const registered &test : tests())
+	{
+		if (!selected(test.name, argc, argv))
+		{
+			continue;
+		}
+		run++;
+		fflush(stdout);
+		start = std::chrono::steady_clock::now();
+
+		child = fork();
+		if (child == 0)
+		{
+			current = test.name;
+			alarm(TIME_LIMIT);
+			test.fn();
+			if (failures > MAX_REPORTS)
+			{
+				printf("  and %d more\n", failures - MAX_REPORTS);
+			}
+			fflush(stdout);
+			_exit(failures ? 1 : 0);
+		}
+		waitpid(child, &status, 0);
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		{
+			printf("ok      %-44s %6.2f s\n", test.name,
+				   std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		}
+		else
+		{
+			failed++;
+			printf("FAILED  %s", test.name);
+			if (WIFSIGNALED(status))
+			{
+				printf(", %s", strsignal(WTERMSIG(status)));
+			}
+			printf("\n");
+		}
+	}
+
+	printf("%d of %d tests passed\n", run - failed, run);
+	return failed ? 1 : 0;
+}
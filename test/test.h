@@ -0,0 +1,69 @@
+#ifndef TEST_TEST_H
+#define TEST_TEST_H
+
+// Tests of the firmware against the simulated ADuC841, built and run by "make test".
+// Each TEST runs in a process of its own on a freshly reset chip, so the firmware and
+// simulator state of one test never leaks into the next. A test either calls firmware
+// functions directly, or sets the chip up with test_sim() and runs the whole firmware
+// with test_run(), then checks what came out on the display, the UART or in the globals.
+//
+// Include this before the firmware headers, their SFR and Keil keyword macros would
+// otherwise reach the standard headers.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "host/sim.h"
+
+struct test_case
+{
+	test_case(const char *name, void (*fn)(void));
+};
+
+#define TEST(name) \
+	static void test_##name(void); \
+	static test_case test_##name##_case(#name, test_##name); \
+	static void test_##name(void)
+
+// Failed checks are printed with their values and fail the test, which carries on
+#define CHECK(condition) \
+	test_check((condition), #condition, __FILE__, __LINE__)
+#define CHECK_EQUAL(expected, actual) \
+	test_check_equal((long long) (expected), (long long) (actual), #actual, __FILE__, __LINE__)
+#define CHECK_NEAR(expected, actual, tolerance) \
+	test_check_near((expected), (actual), (tolerance), #actual, __FILE__, __LINE__)
+#define CHECK_TEXT(expected, actual) \
+	test_check_text((expected), (actual), #actual, __FILE__, __LINE__)
+
+bool test_check(bool ok, const char *text, const char *file, int line);
+bool test_check_equal(long long expected, long long actual, const char *text, const char *file, int line);
+bool test_check_near(double expected, double actual, double tolerance, const char *text, const char *file,
+					 int line);
+bool test_check_text(const std::string &expected, const std::string &actual, const char *text, const char *file,
+					 int line);
+
+// The chip out of reset with instrument options, see host/sim.cpp. The run is quiet and
+// long unless the options say otherwise, so a test that only calls firmware functions
+// never reaches the end.
+void test_sim(const char *options);
+
+// Runs the firmware from main() until the -t time and returns there
+void test_run();
+
+// Everything the firmware sent on the UART
+extern std::vector<uint8> test_uart;
+
+// Telemetry frames in test_uart, see telemetry.h
+struct test_frame
+{
+	uint8  type;
+	double time;					// seconds
+	std::vector<uint8> payload;
+};
+
+std::vector<test_frame> test_frames();
+
+// (time in seconds, value) of the TELEM_READING frames of a mode
+std::vector<std::pair<double, uint32_t> > test_readings(uint8 mode);
+
+#endif
@@ -0,0 +1,731 @@
+// adc_interactions.c, through its ISR and on the simulated ADC.
+// inject() hands adc_isr() a conversion of its own with the ADC stopped, so a sink sees
+// exactly the samples a test gives it.
+
+#include <cmath>
+#include <cstdio>
+#include "test/test.h"
+#include "hal.h"
+#include "adc_interactions.h"
+
+void adc_isr(void);
+
+extern uint8 adc_sink;
+extern uint8 adc_head;
+extern uint8 adc_tail;
+
+#define DC_COUNTS(mv)	((uint16) ((mv) * 4096.0 / 2500 + 0.5))
+
+
+static void inject(uint8 channel, uint16 value)
+{
+	ADCDATAH = (channel << 4) | (value >> 8);
+	ADCDATAL = value & 0xFF;
+	adc_isr();
+}
+
+
+// The ADC calibrated and stopped, with the conversions going to a sink
+static void setup(uint8 sink)
+{
+	test_sim("");
+	adc_setup();
+	adc_sink = sink;
+}
+
+
+TEST(adc_ring_wraparound)
+{
+	uint16 written = 0, read = 0;
+	int round, i;
+
+	setup(ADC_SINK_RING);
+
+	// Uneven batches walk the head and the tail round the ring many times
+	for (round = 0; round < 40; round++)
+	{
+		for (i = 0; i < 37 + round % 50; i++)
+		{
+			inject(2, written++ & 0x0FFF);
+		}
+		CHECK_EQUAL((written - read) & ADC_BUF_MASK, adc_available());
+		while (adc_available())
+		{
+			CHECK_EQUAL(read++ & 0x0FFF, adc_read());
+		}
+	}
+	CHECK(written > 10 * ADC_BUF_SIZE);
+	CHECK_EQUAL(written, read);
+	CHECK_EQUAL(0, adc_overruns);
+	CHECK_EQUAL(adc_head, adc_tail);
+}
+
+
+TEST(adc_ring_overrun)
+{
+	uint16 i;
+
+	setup(ADC_SINK_RING);
+
+	// One slot is always left empty, so the ring holds ADC_BUF_SIZE - 1 samples
+	for (i = 0; i < ADC_BUF_SIZE - 1; i++)
+	{
+		inject(2, 1000 + i);
+	}
+	CHECK_EQUAL(ADC_BUF_SIZE - 1, adc_available());
+	CHECK_EQUAL(0, adc_overruns);
+
+	// Further samples are dropped and counted, the ones already in are kept
+	for (i = 0; i < 300; i++)
+	{
+		inject(2, 3000);
+	}
+	CHECK_EQUAL(300, adc_overruns);
+	CHECK_EQUAL(ADC_BUF_SIZE - 1, adc_available());
+	for (i = 0; i < ADC_BUF_SIZE - 1; i++)
+	{
+		CHECK_EQUAL(1000 + i, adc_read());
+	}
+
+	// Once read there is room again
+	inject(2, 42);
+	CHECK_EQUAL(1, adc_available());
+	CHECK_EQUAL(42, adc_read());
+	CHECK_EQUAL(300, adc_overruns);
+}
+
+
+TEST(adc_ring_running)
+{
+	uint16 i;
+
+	test_sim("-a 2:dc:1234");
+	adc_setup();
+	EA = 1;
+	adc_start(2, ADC_SINK_RING);
+
+	// Read as fast as they come, nothing is lost and the channel id is stripped
+	for (i = 0; i < 1000; i++)
+	{
+		CHECK_EQUAL(DC_COUNTS(1234), adc_read());
+	}
+	CHECK_EQUAL(0, adc_overruns);
+
+	// Left alone the ring fills up and the rest is counted
+	for (i = 0; i < 1000; i++)
+	{
+		sim_idle();
+	}
+	CHECK_EQUAL(ADC_BUF_SIZE - 1, adc_available());
+	CHECK(adc_overruns > 100);
+
+	adc_stop();
+	i = adc_overruns;
+	adc_flush();
+	CHECK_EQUAL(0, adc_available());
+	sim_idle();
+	CHECK_EQUAL(0, adc_available());
+	CHECK_EQUAL(i, adc_overruns);
+}
+
+
+TEST(adc_block_minmax)
+{
+	static uint16 block[300];
+	uint16 lo = 0xFFFF, hi = 0, expected_lo = 0xFFFF, expected_hi = 0, value, i;
+
+	// The channel id in the top nibble is not part of the value
+	for (i = 0; i < 300; i++)
+	{
+		value = (i * 1237 + 500) % 4000 + 10;
+		block[i] = 0xA000 | value;
+		expected_lo = value < expected_lo ? value : expected_lo;
+		expected_hi = value > expected_hi ? value : expected_hi;
+	}
+	adc_block_minmax(block, 300, &lo, &hi);
+	CHECK_EQUAL(expected_lo, lo);
+	CHECK_EQUAL(expected_hi, hi);
+
+	// Another block only widens what is there
+	block[0] = 0xA000 | 4095;
+	block[1] = 0xA000 | 3;
+	adc_block_minmax(block, 1, &lo, &hi);
+	CHECK_EQUAL(expected_lo, lo);
+	CHECK_EQUAL(4095, hi);
+	adc_block_minmax(block + 1, 1, &lo, &hi);
+	CHECK_EQUAL(3, lo);
+	adc_block_minmax(block + 2, 0, &lo, &hi);
+	CHECK_EQUAL(3, lo);
+	CHECK_EQUAL(4095, hi);
+}
+
+
+static uint16 dma_block[257];
+
+// Returns how long the DMA took
+static double capture_block()
+{
+	double start;
+
+	adc_setup();
+	adc_dma_setup(dma_block, 256, 1);
+	CHECK_EQUAL(0xF000, dma_block[256]);
+
+	start = sim_time();
+	adc_dma_start(dma_block);
+	while (!adc_dma_done())
+	{
+		sim_idle();
+	}
+	return sim_time() - start;
+}
+
+
+TEST(adc_dma_block)
+{
+	uint16 lo = 0xFFFF, hi = 0, i;
+	double took;
+
+	// A 2 V square wave about 1.25 V, the block spans both halves of a period
+	test_sim("-a 1:square:2000:2000:1250");
+	took = capture_block();
+
+	// One conversion per slot at the full rate, each written back with its channel id
+	CHECK_NEAR(256.0 * ADC_CONVERSION_CYCLES / F_OSC, took, 5e-6);
+	for (i = 0; i < 256; i++)
+	{
+		CHECK_EQUAL(1, dma_block[i] >> 12);
+	}
+	CHECK_EQUAL(0xF000, dma_block[256]);
+	CHECK_EQUAL(0, ADCCON2 & 0xC0);
+
+	adc_block_minmax(dma_block, 256, &lo, &hi);
+	CHECK_EQUAL(DC_COUNTS(250), lo);
+	CHECK_EQUAL(DC_COUNTS(2250), hi);
+}
+
+
+TEST(adc_dma_sine_peaks)
+{
+	uint16 lo = 0xFFFF, hi = 0;
+
+	// The block covers a whole period of the sine, its reduction is within a count of the peaks
+	test_sim("-a 1:sine:2000:2000:1250");
+	capture_block();
+	adc_block_minmax(dma_block, 256, &lo, &hi);
+	CHECK_NEAR(DC_COUNTS(250), lo, 1);
+	CHECK_NEAR(DC_COUNTS(2250), hi, 1);
+}
+
+
+// adc_to_mV() against the exact conversion for the calibration a zero and a span give
+static void check_conversion(uint16 zero, uint16 span)
+{
+	double exact;
+	uint32 raw;
+
+	adc.zero = zero;
+	adc.scale = ((uint32) ADC_VREF_MV << 16) / span;
+
+	for (raw = 0; raw < ADC_COUNTS; raw++)
+	{
+		exact = raw > zero ? (raw - zero) * (double) ADC_VREF_MV / span : 0;
+		// Half a mV of rounding and the scale rounded down to 1/65536 mV per count
+		CHECK_NEAR(exact, adc_to_mV(raw), 0.5 + ADC_COUNTS / 65536.0);
+	}
+	for (raw = 0; raw < (uint32) ADC_COUNTS << ADC_OVERSAMPLE_BITS; raw++)
+	{
+		exact = raw > (uint32) zero << ADC_OVERSAMPLE_BITS ?
+				(raw / (double) (1 << ADC_OVERSAMPLE_BITS) - zero) * ADC_VREF_MV / span : 0;
+		CHECK_NEAR(exact, adc_oversampled_to_mV(raw), 0.5 + ADC_COUNTS / 65536.0);
+	}
+}
+
+
+TEST(adc_to_mV_matches_float)
+{
+	test_sim("");
+
+	check_conversion(0, ADC_COUNTS);			// nominal
+	check_conversion(0, 4050);					// gain reading low
+	check_conversion(7, 4000);					// and an offset
+	check_conversion(40, 4055);
+}
+
+
+// Calibration against AGND and VREF inputs of a part with a gain error and an offset,
+// the mV of the input channel scaled the same way
+#define PART_MV(mv, gain, zero_mv)	((mv) * (gain) + (zero_mv))
+
+static void calibrate(double gain, double zero_mv)
+{
+	char options[128];
+
+	snprintf(options, sizeof(options), "-a 11:dc:%g -a 12:dc:%g -a 2:dc:%g -a 3:dc:%g -a 4:dc:%g",
+			 zero_mv, PART_MV(ADC_VREF_MV, gain, zero_mv), PART_MV(5, gain, zero_mv),
+			 PART_MV(1234, gain, zero_mv), PART_MV(2400, gain, zero_mv));
+	test_sim(options);
+	adc_setup();
+	EA = 1;
+}
+
+
+static uint16 read_mV(uint8 channel)
+{
+	adc_start(channel, ADC_SINK_RING);
+	return adc_to_mV(get_adc_value(16));
+}
+
+
+TEST(adc_calibrate_nominal)
+{
+	calibrate(1.0, 0);
+	CHECK_EQUAL(0, adc.zero);
+	CHECK_EQUAL(ADC_SCALE_NOMINAL, adc.scale);
+	CHECK_NEAR(1234, read_mV(3), 1);
+}
+
+
+TEST(adc_calibrate_gain_low)
+{
+	// 1.5% low with a 3 count offset, corrected to within a mV
+	calibrate(0.985, 3 * 2500.0 / 4096);
+	CHECK_EQUAL(3, adc.zero);
+	CHECK(adc.scale > ADC_SCALE_NOMINAL);
+	CHECK_NEAR(5, read_mV(2), 1);
+	CHECK_NEAR(1234, read_mV(3), 1);
+	CHECK_NEAR(2400, read_mV(4), 1);
+}
+
+
+TEST(adc_calibrate_saturated_vref)
+{
+	// Reading high saturates VREF, the offset is still taken out but the scale stays nominal
+	calibrate(1.01, 8 * 2500.0 / 4096);
+	CHECK_EQUAL(8, adc.zero);
+	CHECK_EQUAL(ADC_SCALE_NOMINAL, adc.scale);
+	CHECK_NEAR(1234 * 1.01, read_mV(3), 1);
+}
+
+
+TEST(adc_calibrate_rejects_bad_readings)
+{
+	// AGND one count above VREF used to divide by zero
+	test_sim("-a 11:dc:2442.1 -a 12:dc:2441.5");
+	adc_setup();
+	CHECK_EQUAL(0, adc.zero);
+	CHECK_EQUAL(ADC_SCALE_NOMINAL, adc.scale);
+}
+
+
+TEST(adc_calibrate_rejects_equal_readings)
+{
+	test_sim("-a 11:dc:1000 -a 12:dc:1000");
+	adc_setup();
+	CHECK_EQUAL(0, adc.zero);
+	CHECK_EQUAL(ADC_SCALE_NOMINAL, adc.scale);
+}
+
+
+TEST(adc_calibrate_rejects_large_gain_error)
+{
+	// 5% low is more than a part can be off by
+	calibrate(0.95, 0);
+	CHECK_EQUAL(0, adc.zero);
+	CHECK_EQUAL(ADC_SCALE_NOMINAL, adc.scale);
+}
+
+
+TEST(adc_oversample_exact)
+{
+	uint16 k, i;
+
+	setup(ADC_SINK_SUM);
+
+	// k of every 4^n conversions one count up moves the result by k/4^n of a count, the
+	// n extra bits resolve it to the nearest 1/2^n
+	for (k = 0; k <= ADC_OVERSAMPLE_COUNT; k++)
+	{
+		for (i = 0; i < ADC_OVERSAMPLE_COUNT; i++)
+		{
+			inject(2, i < k ? 1001 : 1000);
+		}
+		CHECK_EQUAL(k + 1, adc_sum_count);
+		CHECK_EQUAL((1000L << ADC_OVERSAMPLE_BITS) + ((k + (1 << ADC_OVERSAMPLE_BITS >> 1)) >> ADC_OVERSAMPLE_BITS), adc_filtered);
+	}
+
+	// Full scale fits the 12+n bits
+	for (i = 0; i < ADC_OVERSAMPLE_COUNT; i++)
+	{
+		inject(2, 4095);
+	}
+	CHECK_EQUAL(4095L << ADC_OVERSAMPLE_BITS, adc_filtered);
+}
+
+
+// Mean of the oversampled results of a DC input between two codes, in counts
+static double oversampled_mean(const char *options)
+{
+	test_sim(options);
+	adc_setup();
+	EA = 1;
+	adc_start(2, ADC_SINK_SUM);
+	while (adc_sum_count < 4000)
+	{
+		sim_idle();
+	}
+	adc_stop();
+	return adc_sum / (double) adc_sum_count / (1 << ADC_OVERSAMPLE_BITS);
+}
+
+
+// 1000.3 counts
+#define BETWEEN_CODES_MV	"610.535"
+
+
+TEST(adc_oversample_noise_resolves)
+{
+	// Noise of about an LSB dithers the conversions, the results land between codes
+	CHECK_NEAR(1000.3, oversampled_mean("-n 0.7 -a 2:dc:" BETWEEN_CODES_MV), 0.05);
+}
+
+
+TEST(adc_oversample_without_noise)
+{
+	// Without it every conversion is the same code and the extra bits stay 0
+	CHECK_NEAR(1000.0, oversampled_mean("-a 2:dc:" BETWEEN_CODES_MV), 0.001);
+}
+
+
+// One oversampled result of ADC_OVERSAMPLE_COUNT equal conversions, the filter output after it
+static uint16 filter_result(uint16 value)
+{
+	uint16 i;
+
+	for (i = 0; i < ADC_OVERSAMPLE_COUNT; i++)
+	{
+		inject(2, value);
+	}
+	return adc_filtered;
+}
+
+
+#define RESULT(counts)	((long) (counts) << ADC_OVERSAMPLE_BITS)
+
+
+TEST(adc_filter_median)
+{
+	uint16 i, count;
+
+	setup(ADC_SINK_SUM);
+	adc_set_filter(ADC_FILTER_NONE, 1);
+
+	// A single bad result never gets through
+	for (i = 0; i < 5; i++)
+	{
+		CHECK_EQUAL(RESULT(1000), filter_result(1000));
+	}
+	CHECK_EQUAL(RESULT(1000), filter_result(4000));
+	for (i = 0; i < 5; i++)
+	{
+		CHECK_EQUAL(RESULT(1000), filter_result(1000));
+	}
+
+	// A step does, one result late
+	CHECK_EQUAL(RESULT(1000), filter_result(2000));
+	CHECK_EQUAL(RESULT(2000), filter_result(2000));
+	CHECK_EQUAL(RESULT(2000), filter_result(2000));
+
+	// The median runs once per result, a conversion that is off only moves its result
+	count = adc_sum_count;
+	inject(2, 4000);
+	for (i = 1; i < ADC_OVERSAMPLE_COUNT; i++)
+	{
+		inject(2, 2000);
+	}
+	CHECK_EQUAL(count + 1, adc_sum_count);
+	CHECK_EQUAL(RESULT(2000), adc_filtered);
+}
+
+
+TEST(adc_filter_iir)
+{
+	uint16 i;
+
+	setup(ADC_SINK_SUM);
+	adc_set_filter(ADC_FILTER_IIR, 0);
+
+	// Starts out at the first result
+	CHECK_EQUAL(RESULT(1000), filter_result(1000));
+	CHECK_EQUAL(RESULT(1000), filter_result(1000));
+
+	// An impulse moves it 1/2^ADC_IIR_SHIFT of the way and it decays from there
+	CHECK_NEAR(RESULT(1000) + RESULT(3000) / (double) (1 << ADC_IIR_SHIFT), filter_result(4000), 1);
+	for (i = 0; i < 8 << ADC_IIR_SHIFT; i++)
+	{
+		filter_result(1000);
+	}
+	CHECK_NEAR(RESULT(1000), adc_filtered, 1);
+
+	// A step rises 1 - 1/e of the way in 2^ADC_IIR_SHIFT results
+	for (i = 1; i <= 2 << ADC_IIR_SHIFT; i++)
+	{
+		filter_result(2000);
+		if (i == 1 || i == 100 || i == 1 << ADC_IIR_SHIFT || i == 2 << ADC_IIR_SHIFT)
+		{
+			CHECK_NEAR(RESULT(2000) - RESULT(1000) * pow(1 - 1.0 / (1 << ADC_IIR_SHIFT), i), adc_filtered, 1.5);
+		}
+	}
+}
+
+
+TEST(adc_filter_moving)
+{
+	uint16 i;
+
+	setup(ADC_SINK_SUM);
+	adc_set_filter(ADC_FILTER_MOVING, 0);
+	for (i = 0; i < ADC_MA_SIZE; i++)
+	{
+		filter_result(1000);
+	}
+	CHECK_EQUAL(RESULT(1000), adc_filtered);
+
+	// An impulse lifts the mean by 1/2^ADC_MA_BITS of it for exactly ADC_MA_SIZE results
+	CHECK_EQUAL((RESULT(1000) * (ADC_MA_SIZE - 1) + RESULT(4000)) >> ADC_MA_BITS, filter_result(4000));
+	for (i = 1; i < ADC_MA_SIZE; i++)
+	{
+		CHECK_EQUAL((RESULT(1000) * (ADC_MA_SIZE - 1) + RESULT(4000)) >> ADC_MA_BITS, filter_result(1000));
+	}
+	CHECK_EQUAL(RESULT(1000), filter_result(1000));
+
+	// A step ramps over ADC_MA_SIZE results
+	for (i = 1; i <= ADC_MA_SIZE; i++)
+	{
+		CHECK_EQUAL((RESULT(1000) * (ADC_MA_SIZE - i) + RESULT(2000) * i) >> ADC_MA_BITS, filter_result(2000));
+	}
+	CHECK_EQUAL(RESULT(2000), filter_result(2000));
+}
+
+
+// Triggered capture fed injected samples, stopped so the simulated ADC adds none of its own.
+// Every sample given is logged, so the ring can be checked against the last
+// ADC_CAPTURE_SIZE of them.
+static uint16 capture_ring[ADC_CAPTURE_SIZE];
+static std::vector<uint16> captured;
+
+static void capture_start(uint16 pre_trigger, uint8 edge)
+{
+	test_sim("");
+	adc_setup();
+	adc_capture_start(capture_ring, 2, 2000, edge, pre_trigger);
+	ADCCON2 = 0x00;
+	captured.clear();
+}
+
+
+static void capture_inject(uint16 value)
+{
+	inject(2, value);
+	captured.push_back(value);
+}
+
+
+// The ring in order from adc_capture_first() is the last ADC_CAPTURE_SIZE samples, with
+// the trigger sample at pre_trigger
+static void check_capture(uint16 pre_trigger, size_t trigger)
+{
+	size_t i, first = captured.size() - ADC_CAPTURE_SIZE;
+
+	CHECK(adc_capture_done());
+	CHECK_EQUAL(0, ADCCON2);
+	CHECK_EQUAL(trigger, first + pre_trigger);
+	for (i = 0; i < ADC_CAPTURE_SIZE; i++)
+	{
+		if (!CHECK_EQUAL(captured[first + i], capture_ring[(adc_capture_first() + i) & ADC_CAPTURE_MASK]))
+		{
+			break;
+		}
+	}
+}
+
+
+TEST(adc_capture_trigger)
+{
+	uint16 i;
+
+	capture_start(100, ADC_EDGE_RISING);
+
+	// Starting above the level is not an edge, nor is a crossing before the pre-trigger
+	// samples are in
+	for (i = 0; i < 50; i++)
+	{
+		capture_inject(3000 + i);
+	}
+	capture_inject(100);
+	capture_inject(2500);
+	for (i = 0; i < 200; i++)
+	{
+		capture_inject(1000 + i);
+	}
+
+	// Armed, the first rising crossing fires and the ring fills after it
+	capture_inject(2000);
+	for (i = 1; i < ADC_CAPTURE_SIZE - 100; i++)
+	{
+		CHECK(!adc_capture_done());
+		capture_inject(3500 + i);
+	}
+	check_capture(100, 252);
+
+	// Conversions still in flight once done are dropped
+	inject(2, 4000);
+	check_capture(100, 252);
+}
+
+
+TEST(adc_capture_falling)
+{
+	uint16 i;
+
+	// No pre-trigger, the trigger is the oldest sample
+	capture_start(0, ADC_EDGE_FALLING);
+	capture_inject(1000);
+	capture_inject(3000);
+	capture_inject(2000);
+	capture_inject(1999);
+	for (i = 1; i < ADC_CAPTURE_SIZE; i++)
+	{
+		capture_inject(i);
+	}
+	check_capture(0, 3);
+}
+
+
+TEST(adc_capture_forced)
+{
+	uint16 i;
+
+	// The most pre-trigger the ring holds, with no edge at all
+	capture_start(ADC_CAPTURE_SIZE, ADC_EDGE_RISING);
+	for (i = 0; i < 300; i++)
+	{
+		capture_inject(i);
+	}
+	CHECK(!adc_capture_done());
+	adc_capture_force();
+	capture_inject(300);
+	check_capture(ADC_CAPTURE_SIZE - 1, 300);
+}
+
+
+// Scanning, started with the interrupts off so only injected results reach the ISR. Each
+// one selects the next channel and starts it converting, stopped again before it is done.
+static void scan_inject(uint8 channel, uint16 value)
+{
+	inject(channel, value);
+	ADCCON2 = 0x00;
+}
+
+
+static const uint8 scan_list[] = {2, 5, ADC_TEMP_CHANNEL};
+
+
+TEST(adc_scan_channel_order)
+{
+	int round, i;
+
+	test_sim("");
+	adc_setup();
+	adc_scan_start(scan_list, sizeof(scan_list));
+	CHECK_EQUAL(0x20 | 2, ADCCON2);
+
+	// Round the list in order, every result moving ADCCON2 on by one
+	for (round = 0; round < 5; round++)
+	{
+		for (i = 0; i < (int) sizeof(scan_list); i++)
+		{
+			inject(scan_list[i], 1000 + i);
+			CHECK_EQUAL(0x20 | scan_list[(i + 1) % sizeof(scan_list)], ADCCON2);
+			ADCCON2 = 0x00;
+		}
+	}
+	CHECK_EQUAL(1000 << ADC_SCAN_FRAC_BITS, adc_scan_table[2]);
+	CHECK_EQUAL(1001 << ADC_SCAN_FRAC_BITS, adc_scan_table[5]);
+	CHECK_EQUAL(1002 << ADC_SCAN_FRAC_BITS, adc_scan_table[ADC_TEMP_CHANNEL]);
+	CHECK_EQUAL((1 << 2) | (1 << 5) | (1 << ADC_TEMP_CHANNEL), adc_scan_seen);
+}
+
+
+TEST(adc_scan_files_by_channel_id)
+{
+	test_sim("");
+	adc_setup();
+	adc_scan_start(scan_list, sizeof(scan_list));
+
+	// The result of the conversion started before the switch carries the old channel, it
+	// goes to that channel's slot wherever the list is
+	scan_inject(5, 3000);
+	CHECK_EQUAL(1 << 5, adc_scan_seen);
+	CHECK_EQUAL(3000, adc_scan_read(5));
+	CHECK_EQUAL(0, adc_scan_read(2));
+
+	// Ids past the table, AGND here, are dropped but the list still moves on
+	inject(0x0B, 100);
+	CHECK_EQUAL(0x20 | ADC_TEMP_CHANNEL, ADCCON2);
+	ADCCON2 = 0x00;
+	CHECK_EQUAL(1 << 5, adc_scan_seen);
+}
+
+
+TEST(adc_scan_filter)
+{
+	uint16 i, expected;
+
+	test_sim("");
+	adc_setup();
+	adc_scan_start(scan_list, sizeof(scan_list));
+
+	// The first result starts the filter, then each moves it 1/2^shift of the way, rounded
+	scan_inject(2, 1000);
+	expected = 1000 << ADC_SCAN_FRAC_BITS;
+	for (i = 0; i < 200; i++)
+	{
+		scan_inject(2, 2000);
+		expected += ((2000 << ADC_SCAN_FRAC_BITS) - expected + (1 << ADC_SCAN_FILTER_SHIFT >> 1)) >> ADC_SCAN_FILTER_SHIFT;
+		CHECK_EQUAL(expected, adc_scan_table[2]);
+	}
+	CHECK_NEAR(2000, adc_scan_read(2), 1);
+
+	// and settles as close going down
+	for (i = 0; i < 200; i++)
+	{
+		scan_inject(2, 1000);
+	}
+	CHECK_NEAR(1000, adc_scan_read(2), 1);
+	CHECK_EQUAL(0, adc_scan_read(ADC_SCAN_CHANNELS));
+}
+
+
+TEST(adc_scan_running)
+{
+	static const uint8 channels[] = {0, 2, 5, 7};
+	uint16 i;
+
+	test_sim("-a 0:dc:300 -a 2:dc:1000 -a 5:dc:2000 -a 7:dc:2400");
+	adc_setup();
+	EA = 1;
+	adc_scan_start(channels, sizeof(channels));
+	for (i = 0; i < 2000; i++)
+	{
+		sim_idle();
+	}
+
+	// No channel picks up any of the one converted before it
+	CHECK_NEAR(300, adc_scan_mV(0), 1);
+	CHECK_NEAR(1000, adc_scan_mV(2), 1);
+	CHECK_NEAR(2000, adc_scan_mV(5), 1);
+	CHECK_NEAR(2400, adc_scan_mV(7), 1);
+	CHECK_EQUAL((1 << 0) | (1 << 2) | (1 << 5) | (1 << 7), adc_scan_seen);
+	adc_stop();
+}
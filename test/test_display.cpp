@@ -0,0 +1,448 @@
+// display.c on the simulated MAX7219. Every latch the display sees is logged with the
+// 16 bits it took and how many bits were clocked since the one before.
+
+#include <cstdio>
+#include <string>
+#include "test/test.h"
+#include "hal.h"
+#include "display.h"
+#include "measurements.h"
+
+extern bit spi_busy;
+
+struct latch
+{
+	uint16 word;
+	uint8  bits;
+};
+
+static std::vector<latch> latches;
+
+static void logged(uint16 word, uint8 bits)
+{
+	latch entry = {word, bits};
+
+	latches.push_back(entry);
+}
+
+
+// A display set up and written out, with the log empty
+static void setup()
+{
+	test_sim("");
+	sim_load = logged;
+	display_setup();
+}
+
+
+static void drain()
+{
+	while (spi_busy)
+	{
+		sim_idle();
+	}
+}
+
+
+// Register writes logged since the last call, after the queue has gone out
+static size_t writes()
+{
+	size_t count;
+
+	drain();
+	count = latches.size();
+	latches.clear();
+	return count;
+}
+
+
+TEST(display_unchanged_digits_not_sent)
+{
+	setup();
+	CHECK_EQUAL(4, writes());					// decode, intensity, scan limit and shutdown
+
+	// The first reading writes every digit, the same one again writes nothing
+	display(1234, DC_MODE);
+	CHECK_EQUAL(8, writes());
+	CHECK_TEXT(" 1.234  V", sim_display());
+	display(1234, DC_MODE);
+	CHECK_EQUAL(0, writes());
+
+	// Only the digits that changed
+	display(1235, DC_MODE);
+	CHECK_EQUAL(1, writes());
+	display(1300, DC_MODE);
+	CHECK_EQUAL(3, writes());
+	CHECK_TEXT(" 1.300  V", sim_display());
+
+	// mV brings the m in and moves the dot, the V stays
+	display(512, DC_MODE);
+	CHECK_EQUAL(6, writes());
+	CHECK_TEXT("  512mV", sim_display());
+
+	// Hz with the same digits, only the ones that moved and the units
+	display(51200, FREQ_MODE);
+	CHECK_EQUAL(8, writes());
+	CHECK_TEXT("512.00 HZ", sim_display());
+	display(51300, FREQ_MODE);
+	CHECK_EQUAL(1, writes());
+	display(5130000, FREQ_MODE);
+	CHECK_EQUAL(3, writes());					// the dot moves and the k comes in
+	CHECK_TEXT("51.300kHZ", sim_display());
+}
+
+
+TEST(display_writes_match_changes)
+{
+	uint8 before[8], i, mode;
+	uint32 random = 1, value;
+	size_t changed;
+	int n;
+
+	setup();
+	display(0, DC_MODE);
+	writes();
+
+	// A long run of readings, each one sends exactly the digit registers that differ
+	for (n = 0; n < 3000; n++)
+	{
+		for (i = 0; i < 8; i++)
+		{
+			before[i] = sim_display_register(DIG_0 + i);
+		}
+		random = random * 1103515245u + 12345;
+		value = (random >> 8) % ((n % 3) ? 20000000 : 2000);
+		mode = (n % 7 == 0) ? FREQ_MODE : DC_MODE;
+		display(value, mode);
+
+		drain();
+		for (changed = 0, i = 0; i < 8; i++)
+		{
+			changed += before[i] != sim_display_register(DIG_0 + i);
+		}
+		CHECK_EQUAL(changed, writes());
+	}
+}
+
+
+TEST(spi_load_framing)
+{
+	uint8 i;
+
+	setup();
+
+	// Each write is latched once, after exactly its own 16 bits, in the order queued
+	for (i = 0; i < 40; i++)
+	{
+		write_spi(DIG_0 + i % 8, i);
+	}
+	drain();
+	CHECK_EQUAL(44, latches.size());
+	for (i = 0; i < latches.size(); i++)
+	{
+		CHECK_EQUAL(16, latches[i].bits);
+	}
+	for (i = 0; i < 40; i++)
+	{
+		CHECK_EQUAL(((DIG_0 + i % 8) << 8) | i, latches[4 + i].word);
+	}
+
+	CHECK_EQUAL(0, SPICON & 0x40);				// WCOL, no byte was written over a transfer
+	CHECK_EQUAL(1, LOAD);						// left high, the next write starts the frame
+}
+
+
+TEST(spi_queue_full)
+{
+	double start;
+	uint8 i;
+
+	setup();
+	drain();
+	latches.clear();
+
+	// A write only takes as long as queueing it while there is room
+	start = sim_time();
+	for (i = 0; i < SPI_QUEUE_SIZE - 1; i++)
+	{
+		write_spi(DIG_0 + i % 8, i);
+	}
+	CHECK(latches.size() < 3);
+	CHECK(sim_time() - start < 15 * 64.0 / F_OSC);	// less than sending them takes
+
+	// Once full the next one waits for spi_isr to send one, and nothing is lost
+	write_spi(DIG_7, 0x55);
+	CHECK(latches.size() >= 1);
+	drain();
+	CHECK_EQUAL(SPI_QUEUE_SIZE, latches.size());
+	for (i = 0; i < SPI_QUEUE_SIZE - 1; i++)
+	{
+		CHECK_EQUAL(((DIG_0 + i % 8) << 8) | i, latches[i].word);
+	}
+	CHECK_EQUAL((DIG_7 << 8) | 0x55, latches[SPI_QUEUE_SIZE - 1].word);
+	CHECK_EQUAL(0, SPICON & 0x40);
+}
+
+
+// The digits of write_number() the way display() used to find them, with % and /
+static void reference_digits(uint32 value, uint8 dot_position, uint8 expected[5])
+{
+	static const uint8 numbers[10] = {NUM_0, NUM_1, NUM_2, NUM_3, NUM_4, NUM_5, NUM_6, NUM_7, NUM_8, NUM_9};
+	uint8 first = (dot_position == NO_DOT) ? 0 : dot_position;
+	uint8 digit[5];
+	bool leading = true;
+	int i;
+
+	if (value > NUMBER_MAX)
+	{
+		value = NUMBER_MAX;
+	}
+	for (i = 0; i < 5; i++)
+	{
+		digit[i] = value % 10;
+		value /= 10;
+	}
+
+	for (i = 4; i >= 0; i--)
+	{
+		if (digit[i] != 0 || i <= first)
+		{
+			leading = false;
+		}
+		expected[i] = leading ? 0x00 : numbers[digit[i]];
+		if (dot_position == i)
+		{
+			expected[i] |= NUM_dot;
+		}
+	}
+}
+
+
+extern uint8 xdata digit_shadow[8];
+
+static void check_number(uint32 value, uint8 dot_position)
+{
+	uint8 expected[5];
+	int i;
+
+	write_number(value, dot_position);
+	reference_digits(value, dot_position, expected);
+	for (i = 0; i < 5; i++)
+	{
+		if (!CHECK_EQUAL(expected[i], digit_shadow[DIG_3 - DIG_0 + i]))
+		{
+			printf("    value %u, dot %u, digit %d\n", (unsigned) value, dot_position, i);
+		}
+	}
+}
+
+
+TEST(write_number_matches_division)
+{
+	static const uint8 dots[] = {NO_DOT, 0, 1, 2, 3, 4};
+	uint32 value;
+	size_t d;
+	int i;
+
+	setup();
+
+	// Every 16 bit value with every dot position
+	for (d = 0; d < sizeof(dots); d++)
+	{
+		for (value = 0; value <= 0xFFFF; value++)
+		{
+			check_number(value, dots[d]);
+		}
+	}
+	for (value = 0x10000; value <= NUMBER_MAX; value += 7)
+	{
+		check_number(value, NO_DOT);
+	}
+
+	// What was sent is what the shadow says
+	drain();
+	for (i = DIG_3; i <= DIG_7; i++)
+	{
+		CHECK_EQUAL(digit_shadow[i - DIG_0], sim_display_register(i));
+	}
+}
+
+
+TEST(write_number_clamps)
+{
+	static const uint32 values[] = {NUMBER_MAX, NUMBER_MAX + 1, 100005, 123456, 999999, 1000000,
+									0x7FFFFFFF, 0x80000000u, 0xFFFFFFFFu};
+	size_t i;
+
+	setup();
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+	{
+		check_number(values[i], NO_DOT);
+		drain();
+		CHECK_TEXT("99999", std::string(sim_display()).substr(0, 5));
+		check_number(values[i], 2);
+		drain();
+		CHECK_TEXT("999.99", std::string(sim_display()).substr(0, 6));
+	}
+}
+
+
+
+static unsigned long long power_of_ten(int n)
+{
+	unsigned long long power = 1;
+
+	while (n-- > 0)
+	{
+		power *= 10;
+	}
+	return power;
+}
+
+
+// write_scaled() with / and 64 bits, so nothing overflows
+static int reference_scaled(uint32 value, int decimals, int lowest, int highest, int significant,
+							uint32 *number, int *dot)
+{
+	unsigned long long rounded = value, power;
+	int digits = std::to_string(value).size(), dropped = 0, prefix = 0;
+
+	if (significant == 0 || significant > NUMBER_DIGITS)
+	{
+		significant = NUMBER_DIGITS;
+	}
+	if (digits > significant)
+	{
+		dropped = digits - significant;
+		power = power_of_ten(dropped);
+		rounded = (value + power / 2) / power;
+	}
+	if ((int) std::to_string(rounded).size() > significant)
+	{
+		rounded = (rounded + 5) / 10;		// 99996 to 10000, the carry digit is a 0
+		dropped++;
+	}
+	digits = std::to_string(rounded).size();
+
+	*dot = decimals - dropped;
+	while (digits - *dot > 3 && prefix < highest)
+	{
+		prefix++;
+		*dot += 3;
+	}
+	while (digits - *dot < 1 && prefix > lowest)
+	{
+		prefix--;
+		*dot -= 3;
+	}
+	if (*dot < 0)
+	{
+		rounded = NUMBER_MAX;
+		*dot = 0;
+	}
+	if (*dot > 4)
+	{
+		power = power_of_ten(*dot - 4);
+		rounded = (rounded + power / 2) / power;
+		*dot = 4;
+	}
+	*number = (uint32) rounded;
+	return prefix;
+}
+
+
+static void check_scaled(uint32 value, int decimals, int lowest, int highest, int significant)
+{
+	uint8 expected[5];
+	uint32 number;
+	int dot, prefix, i;
+
+	prefix = reference_scaled(value, decimals, lowest, highest, significant, &number, &dot);
+	reference_digits(number, dot == 0 ? NO_DOT : dot, expected);
+	if (!CHECK_EQUAL(prefix, write_scaled(value, decimals, lowest, highest, significant)))
+	{
+		printf("    value %u, significant %d\n", (unsigned) value, significant);
+	}
+	for (i = 0; i < 5; i++)
+	{
+		if (!CHECK_EQUAL(expected[i], digit_shadow[DIG_3 - DIG_0 + i]))
+		{
+			printf("    value %u, significant %d, digit %d\n", (unsigned) value, significant, i);
+			break;
+		}
+	}
+}
+
+
+// Every range of each mode around each power of ten and over the whole 32 bits, to every
+// number of significant digits
+TEST(write_scaled_matches_division)
+{
+	static const int ranges[][3] = {{3, PREFIX_MILLI, PREFIX_NONE}, {2, PREFIX_NONE, PREFIX_MEGA},
+									{3, PREFIX_NONE, PREFIX_NONE}, {3, PREFIX_MILLI, PREFIX_MILLI},
+									{0, PREFIX_NONE, PREFIX_NONE}, {6, PREFIX_NONE, PREFIX_NONE}};
+	uint32 value, step;
+	int r, significant, k, i;
+
+	setup();
+	for (r = 0; r < (int) (sizeof(ranges) / sizeof(ranges[0])); r++)
+	{
+		for (significant = 0; significant <= NUMBER_DIGITS; significant++)
+		{
+			for (value = 0; value < 2000; value++)
+			{
+				check_scaled(value, ranges[r][0], ranges[r][1], ranges[r][2], significant);
+			}
+			for (k = 1; k <= 9; k++)
+			{
+				// Either side of 10^k and of the rounding that carries into it
+				for (i = -60; i <= 60; i++)
+				{
+					check_scaled((uint32) power_of_ten(k) + i, ranges[r][0], ranges[r][1], ranges[r][2], significant);
+					check_scaled((uint32) (power_of_ten(k) - power_of_ten(k > 5 ? k - 5 : 0) / 2) + i,
+								 ranges[r][0], ranges[r][1], ranges[r][2], significant);
+				}
+			}
+			for (value = 2000, step = 1; value < 0xFFFFFFFFu - step; value += step, step += step / 8 + 1)
+			{
+				check_scaled(value, ranges[r][0], ranges[r][1], ranges[r][2], significant);
+			}
+			check_scaled(0xFFFFFFFFu, ranges[r][0], ranges[r][1], ranges[r][2], significant);
+		}
+	}
+}
+
+
+extern uint8 xdata meas_digits;
+
+TEST(display_blanks_digits_without_information)
+{
+	setup();
+
+	// 1230.0 Hz from a counted reading of 4 digits of edges, the 0.1 Hz would always be 0
+	meas_digits = 4;
+	display(123000, FREQ_MODE);
+	drain();
+	CHECK_TEXT(" 1.230kHZ", sim_display());
+
+	// rounded to them, and the integer digits are never left out
+	display(123456, FREQ_MODE);
+	drain();
+	CHECK_TEXT(" 1.235kHZ", sim_display());
+	meas_digits = 3;
+	display(9999900, FREQ_MODE);
+	drain();
+	CHECK_TEXT("  100kHZ", sim_display());
+
+	// A timed reading has every digit
+	meas_digits = 0;
+	display(123000, FREQ_MODE);
+	drain();
+	CHECK_TEXT("1.2300kHZ", sim_display());
+
+	// Only frequency readings have a digit count
+	meas_digits = 2;
+	display(1234, DC_MODE);
+	drain();
+	CHECK_TEXT(" 1.234  V", sim_display());
+}
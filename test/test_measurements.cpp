@@ -0,0 +1,443 @@
+// measurements.c, the whole firmware running on the simulator with readings telemetry on
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "test/test.h"
+#include "hal.h"
+#include "config.h"
+#include "measurements.h"
+#include "telemetry.h"
+
+#define READINGS_ON	"-r t@0.05"
+
+
+// Runs frequency mode on a sine for a while and returns the readings after the first, which
+// comes from the shortest gate whatever the input
+static std::vector<std::pair<double, uint32_t> > frequency_readings(double hz, double seconds)
+{
+	std::vector<std::pair<double, uint32_t> > readings;
+	char options[128];
+
+	snprintf(options, sizeof(options), "-t %g -s 02 -a 1:sine:%g:2000:1250 " READINGS_ON, seconds, hz);
+	test_sim(options);
+	test_run();
+
+	readings = test_readings(FREQ_MODE);
+	if (CHECK(readings.size() >= 2))
+	{
+		readings.erase(readings.begin());
+	}
+	return readings;
+}
+
+
+// Each reading against the input, hz in 0.01 Hz. A timed reading resolves the edges to a
+// few core cycles of the 100 ms gate, a counted one to an edge in its gate. The count also
+// starts and stops up to GATE_SKEW core cycles away from the ends of the gate, the ISR
+// latency, which only shows in the 6th digit of a MHz input.
+#define GATE_SKEW		32
+
+static void check_frequency(double hz, bool timed, double seconds)
+{
+	std::vector<std::pair<double, uint32_t> > readings = frequency_readings(hz, seconds);
+	double last = 0, gate, tolerance;
+	size_t i;
+
+	for (i = 0; i < readings.size(); i++)
+	{
+		gate = readings[i].first - (i ? readings[i - 1].first : last) - 2 * TICK_MS / 1000.0;
+		gate = gate > GATE_MS / 1000.0 ? gate : GATE_MS / 1000.0;
+		tolerance = timed ? 50e-6 * hz + 0.01 : (1 + hz * GATE_SKEW / F_OSC) / gate + 0.01;
+		CHECK_NEAR(hz, readings[i].second / 100.0, tolerance);
+	}
+}
+
+
+// Edges interrupt only while the reading is timed
+static void check_timed(double hz, bool timed)
+{
+	char options[64];
+	double per_s;
+
+	snprintf(options, sizeof(options), "-t 2 -s 02 -a 1:sine:%g:2000:1250", hz);
+	test_sim(options);
+	test_run();
+
+	per_s = sim_isr_calls(5) / 2.0;
+	if (timed)
+	{
+		CHECK_NEAR(hz, per_s, 0.1 * hz);
+	}
+	else
+	{
+		CHECK(per_s < 0.1 * hz);
+	}
+}
+
+
+TEST(frequency_timed_low)
+{
+	check_frequency(3.3, true, 4);
+	CHECK(test_readings(FREQ_MODE).size() >= 5);
+}
+
+
+TEST(frequency_timed_below_recip_max)
+{
+	check_frequency(RECIP_MAX_HZ * 0.9, true, 2);
+}
+
+
+TEST(frequency_timed_at_recip_max)
+{
+	check_frequency(RECIP_MAX_HZ * 0.99 + 0.37, true, 2);
+}
+
+
+TEST(frequency_counted_at_recip_max)
+{
+	check_frequency(RECIP_MAX_HZ * 1.01 + 0.37, false, 3);
+}
+
+
+TEST(frequency_counted_above_recip_max)
+{
+	check_frequency(RECIP_MAX_HZ * 1.1, false, 3);
+}
+
+
+// The gate an input settles on: the shortest below RECIP_MAX_HZ, where the edges are timed,
+// and above it the shortest that counts GATE_EDGES, up to the longest. Either way a reading
+// comes at least every GATE_MAX_MS and is good to the tolerance of check_frequency().
+static void check_gate(double hz)
+{
+	std::vector<std::pair<double, uint32_t> > readings;
+	double gate = GATE_MS / 1000.0;
+	size_t i;
+
+	if (hz > RECIP_MAX_HZ)
+	{
+		while (hz * gate < GATE_EDGES && gate < (GATE_MS << GATE_MAX_STEP) / 1000.0)
+		{
+			gate *= 2;
+		}
+	}
+
+	check_frequency(hz, hz <= RECIP_MAX_HZ, 4);
+	readings = test_readings(FREQ_MODE);
+	CHECK(readings.size() >= 4);
+	for (i = 1; i < readings.size(); i++)
+	{
+		CHECK(readings[i].first - readings[i - 1].first <= GATE_MAX_MS / 1000.0 + 2 * TICK_MS / 1000.0);
+	}
+	CHECK_NEAR(gate, readings.back().first - readings[readings.size() - 2].first, 2.5 * TICK_MS / 1000.0);
+}
+
+
+TEST(frequency_gate_1khz)			{ check_gate(1000); }
+TEST(frequency_gate_5khz)			{ check_gate(5000); }
+TEST(frequency_gate_15khz)			{ check_gate(15000); }
+TEST(frequency_gate_20khz)			{ check_gate(20000); }
+TEST(frequency_gate_60khz)			{ check_gate(60000); }
+TEST(frequency_gate_200khz)			{ check_gate(200000); }
+TEST(frequency_gate_1mhz)			{ check_gate(1000000); }
+
+
+TEST(frequency_interrupts_per_edge_when_timed)
+{
+	check_timed(RECIP_MAX_HZ * 0.9, true);
+}
+
+
+TEST(frequency_counts_without_interrupts_above)
+{
+	check_timed(RECIP_MAX_HZ * 1.1, false);
+}
+
+
+// A mode switched off part way through a reading must leave nothing running behind it
+static uint64_t switched_calls[2];
+
+static void switched()
+{
+	switched_calls[0] = sim_isr_calls(5);
+	switched_calls[1] = sim_isr_calls(6);
+}
+
+
+static void check_stopped()
+{
+	CHECK_EQUAL(0, EADC);
+	CHECK_EQUAL(0, ET2);
+	CHECK_EQUAL(0, TR2);
+	CHECK_EQUAL(0, PT2);
+	CHECK_EQUAL(0, ADCCON2 & 0x70);				// no DMA, continuous or single conversions
+	CHECK_EQUAL(ADC_CON1, ADCCON1);				// nor any from timer 2
+	CHECK_EQUAL(switched_calls[0], sim_isr_calls(5));
+	CHECK_EQUAL(switched_calls[1], sim_isr_calls(6));
+	CHECK_EQUAL(0, measurement_value());
+}
+
+
+static void check_switch_off(const char *mode, const char *input, bool read)
+{
+	char options[128];
+
+	snprintf(options, sizeof(options), "-t 1.2 -s %s -s 00@0.53 -a 1:%s " READINGS_ON, mode, input);
+	test_sim(options);
+	sim_at(0.56, switched);
+	sim_at(1.1, check_stopped);
+	test_run();
+
+	CHECK_EQUAL(read, test_readings(strtoul(mode, 0, 16)).size() > 0);	// a reading came before the switch
+}
+
+
+// The scan and the fixed amplitude window last 1 s, they are stopped before their first reading
+TEST(switch_off_dc)				{ check_switch_off("01", "sine:1000:2000:1250", true); }
+TEST(switch_off_frequency_timed)	{ check_switch_off("02", "sine:500:2000:1250", true); }
+TEST(switch_off_frequency_counted)	{ check_switch_off("02", "sine:50000:2000:1250", true); }
+TEST(switch_off_amplitude)		{ check_switch_off("04", "sine:1000:2000:1250", true); }
+TEST(switch_off_amplitude_ets)	{ check_switch_off("04", "sine:50000:2000:1250", true); }
+TEST(switch_off_amplitude_dma)	{ check_switch_off("04", "dc:1000", false); }
+TEST(switch_off_rms)			{ check_switch_off("08", "sine:1000:2000:1250", true); }
+TEST(switch_off_scan)			{ check_switch_off("10", "sine:1000:2000:1250", false); }
+TEST(switch_off_capture)		{ check_switch_off("20", "sine:1000:2000:1250", true); }
+
+
+// Straight from one task to another, the first reading of the new mode is its own
+TEST(switch_amplitude_to_dc)
+{
+	std::vector<std::pair<double, uint32_t> > readings;
+
+	test_sim("-t 1.5 -s 04 -s 01@0.53 -a 1:sine:50000:2000:1250 -a 2:dc:1234 " READINGS_ON);
+	sim_at(0.56, switched);
+	test_run();
+
+	readings = test_readings(DC_MODE);
+	CHECK(readings.size() >= 8);
+	for (const std::pair<double, uint32_t> &reading : readings)
+	{
+		CHECK(reading.first > 0.53);
+		CHECK_NEAR(1234, reading.second, 1);
+	}
+	CHECK_EQUAL(switched_calls[0], sim_isr_calls(5));
+	CHECK(test_readings(AMP_MODE).size() > 0);
+}
+
+
+// RMS mode on a waveform against its exact RMS, the reading has the same factor of 2 as
+// the peak to peak. Each one must be within 0.5%, a few counts of the 12 bit conversions.
+static void check_rms(const char *input, double rms_mv)
+{
+	std::vector<std::pair<double, uint32_t> > readings;
+	char options[128];
+
+	snprintf(options, sizeof(options), "-t 2 -s 08 -a 1:%s " READINGS_ON, input);
+	test_sim(options);
+	test_run();
+
+	readings = test_readings(RMS_MODE);
+	CHECK(readings.size() >= 5);
+	for (const std::pair<double, uint32_t> &reading : readings)
+	{
+		CHECK_NEAR(2 * rms_mv, reading.second, 2 * rms_mv * 0.005 + 2);
+	}
+}
+
+
+TEST(rms_sine)				{ check_rms("sine:1000:2000:1250", 1000 / sqrt(2.0)); }
+TEST(rms_sine_low)			{ check_rms("sine:50:1000:1250", 500 / sqrt(2.0)); }
+TEST(rms_sine_high)			{ check_rms("sine:5000:2000:1250", 1000 / sqrt(2.0)); }
+TEST(rms_square)			{ check_rms("square:1000:2000:1250", 1000); }
+TEST(rms_triangle)			{ check_rms("triangle:1000:2000:1250", 1000 / sqrt(3.0)); }
+TEST(rms_dc)				{ check_rms("dc:1500", 0); }
+
+
+// Amplitude mode readings in mV, peak to peak doubled by the input circuit, and the last
+// one as measurement_value() holds it
+static uint32 amp_value;
+
+static void amp_latest()
+{
+	amp_value = measurement_value();
+}
+
+
+static void check_amplitude(const char *options, double mvpp)
+{
+	std::vector<std::pair<double, uint32_t> > readings;
+	char all[160];
+
+	snprintf(all, sizeof(all), "-t 4 -s 04 %s " READINGS_ON, options);
+	test_sim(all);
+	sim_at(3.99, amp_latest);
+	test_run();
+
+	readings = test_readings(AMP_MODE);
+	CHECK(readings.size() >= 2);
+	for (const std::pair<double, uint32_t> &reading : readings)
+	{
+		CHECK_NEAR(2 * mvpp, reading.second, 2 * mvpp * 0.005 + 2);
+	}
+	CHECK_NEAR(2 * mvpp, amp_value, 2 * mvpp * 0.005 + 2);
+}
+
+
+// Edge synchronised windows of the peak detector up to ~2 kHz, equivalent time above
+TEST(amplitude_sine_100hz)		{ check_amplitude("-a 1:sine:100:2000:1250", 2000); }
+TEST(amplitude_sine_1khz)		{ check_amplitude("-a 1:sine:1000:2000:1250", 2000); }
+TEST(amplitude_sine_1728hz)		{ check_amplitude("-a 1:sine:1728:2000:1250", 2000); }	// 1/40 of the rate
+TEST(amplitude_sine_small)		{ check_amplitude("-a 1:sine:1000:300:1250", 300); }
+TEST(amplitude_triangle)		{ check_amplitude("-a 1:triangle:500:1500:1250", 1500); }
+TEST(amplitude_sine_ets)		{ check_amplitude("-a 1:sine:5000:2000:1250", 2000); }
+TEST(amplitude_sine_ets_high)	{ check_amplitude("-a 1:sine:100000:1000:1250", 1000); }
+
+// With the schmitt threshold above the input there are no edges, the DMA blocks take it
+TEST(amplitude_dma_sine)		{ check_amplitude("-x 1:3000 -a 1:sine:1000:2000:1250", 2000); }
+TEST(amplitude_dma_sine_small)	{ check_amplitude("-x 1:3000 -a 1:sine:1000:500:1250", 500); }
+TEST(amplitude_dma_square)		{ check_amplitude("-x 1:3000 -a 1:square:200:1500:1250", 1500); }
+
+
+// Conversions a second from 0.5 s to 1.5 s into a run. The sinks that interrupt per
+// conversion run at ADC_CON1_SLOW, not the full rate the ISR could not keep up with.
+static uint64_t adc_calls;
+
+static void adc_counted()
+{
+	adc_calls = sim_isr_calls(6);
+}
+
+
+static double conversion_rate(const char *options)
+{
+	char all[128];
+
+	snprintf(all, sizeof(all), "-t 1.5 %s " READINGS_ON, options);
+	test_sim(all);
+	sim_at(0.5, adc_counted);
+	test_run();
+	return sim_isr_calls(6) - adc_calls;
+}
+
+
+#define SLOW_RATE	(F_OSC / (double) ADC_SLOW_CYCLES)
+
+TEST(rms_conversion_rate)
+{
+	CHECK_NEAR(SLOW_RATE, conversion_rate("-s 08 -a 1:sine:1000:2000:1250"), SLOW_RATE * 0.01);
+}
+
+
+// Scan mode as well, thousands of results a second for each of its channels
+TEST(scan_conversion_rate)
+{
+	CHECK_NEAR(SLOW_RATE, conversion_rate("-s 10 -a 2:dc:1234"), SLOW_RATE * 0.01);
+}
+
+
+// The peak detector at ADC_CON1_PEAK, faster than the slow rate for more points a period
+TEST(amplitude_conversion_rate)
+{
+	CHECK_NEAR(F_OSC / (double) ADC_PEAK_CYCLES, conversion_rate("-s 04 -a 1:sine:1000:2000:1250"),
+			   F_OSC / (double) ADC_PEAK_CYCLES * 0.01);
+}
+
+
+// and DC mode still reads its input
+TEST(dc_conversion_rate)
+{
+	CHECK_NEAR(SLOW_RATE, conversion_rate("-s 01 -a 2:dc:1234"), SLOW_RATE * 0.01);
+	CHECK(test_readings(DC_MODE).size() >= 10);
+	for (const std::pair<double, uint32_t> &reading : test_readings(DC_MODE))
+	{
+		CHECK_NEAR(1234, reading.second, 1);
+	}
+}
+
+
+#if AMP_ETS
+// Equivalent time traces of amplitude mode, in mV. Each is sent in several frames, the
+// first one at offset 0.
+static std::vector<std::vector<double> > ets_traces(const char *input)
+{
+	std::vector<std::vector<double> > traces;
+	std::vector<double> trace;
+	char options[128];
+	size_t size = 0, i;
+
+	snprintf(options, sizeof(options), "-t 1 -s 04 -r tb@0.05 -a 1:%s", input);
+	test_sim(options);
+	test_run();
+
+	for (const test_frame &frame : test_frames())
+	{
+		if (frame.type != TELEM_TRACE || frame.payload.size() < 8)
+		{
+			continue;
+		}
+		CHECK_EQUAL(0, frame.payload[6] << 8 | frame.payload[7]);	// the edge starts the trace
+		if ((frame.payload[4] << 8 | frame.payload[5]) == 0)
+		{
+			size = frame.payload[2] << 8 | frame.payload[3];
+			trace.clear();
+		}
+		for (i = 8; i + 1 < frame.payload.size(); i += 2)
+		{
+			trace.push_back((frame.payload[i] << 8 | frame.payload[i + 1]) * VREF_MV / 4096.0);
+		}
+		if (size && trace.size() == size)
+		{
+			traces.push_back(trace);
+			size = 0;
+		}
+	}
+	return traces;
+}
+
+
+// Every trace is one period of the sine in time order: its peak to peak is the input's and
+// what is left after the fundamental is only the timing of the points, within a core cycle
+// rms. Out of order or over more or less than a period the fit leaves far more.
+static void check_ets_sine(double hz)
+{
+	std::vector<std::vector<double> > traces;
+	char input[64];
+	double mean, a, b, fit, residual, phase, slope;
+	size_t n, k;
+
+	snprintf(input, sizeof(input), "sine:%g:2000:1250", hz);
+	traces = ets_traces(input);
+	CHECK(traces.size() >= 5);
+	slope = 2 * M_PI * hz * 1000 / F_OSC;		// steepest mV per core cycle
+	for (const std::vector<double> &trace : traces)
+	{
+		n = trace.size();
+		CHECK_EQUAL(ETS_POINTS, n);
+		for (mean = a = b = 0, k = 0; k < n; k++)
+		{
+			phase = 2 * M_PI * k / n;
+			mean += trace[k] / n;
+			a += 2 * trace[k] * cos(phase) / n;
+			b += 2 * trace[k] * sin(phase) / n;
+		}
+		for (residual = 0, k = 0; k < n; k++)
+		{
+			phase = 2 * M_PI * k / n;
+			fit = mean + a * cos(phase) + b * sin(phase);
+			residual += (trace[k] - fit) * (trace[k] - fit) / n;
+		}
+		CHECK_NEAR(1000, hypot(a, b), 10);
+		CHECK_NEAR(1250, mean, 10);
+		CHECK(sqrt(residual) < slope);
+		CHECK_NEAR(2000, *std::max_element(trace.begin(), trace.end()) - *std::min_element(trace.begin(), trace.end()), 20);
+	}
+}
+
+
+TEST(amplitude_ets_sine)				{ check_ets_sine(50000); }
+TEST(amplitude_ets_sine_locked)			{ check_ets_sine(34560); }	// 1/8 of the conversion rate
+TEST(amplitude_ets_sine_high)			{ check_ets_sine(100000); }
+#endif
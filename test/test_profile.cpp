@@ -0,0 +1,138 @@
+// profile.c and the probe macros. The firmware objects are normally built without PROFILE,
+// so this file then brings in the enabled profile.c itself.
+
+#ifdef PROFILE
+#define PROFILE_LINKED
+#else
+#define PROFILE
+#endif
+#include <string>
+#include "test/test.h"
+#include "hal.h"
+#include "profile.h"
+#include "uart.h"
+#ifndef PROFILE_LINKED
+#include "profile.c"
+#endif
+
+// Timer 1 free running at the core clock as setup_frequency_timers() leaves it, the probes
+// cleared
+static void setup()
+{
+	test_sim("");
+	TMOD |= 0x10;
+	TR1 = 1;
+	prof_setup();
+}
+
+
+// One timed run of a probe lasting idles simulated wait loops
+static void timed(uint8 idles)
+{
+	uint8 i;
+
+	PROF_ENTER(PROF_DISPLAY);
+	for (i = 0; i < idles; i++)
+	{
+		sim_idle();
+	}
+	PROF_EXIT(PROF_DISPLAY);
+}
+
+
+TEST(prof_min_max_mean)
+{
+	PROF_PROBE &probe = prof_table[PROF_DISPLAY];
+	uint16 base;
+
+	setup();
+	CHECK_EQUAL(0, probe.count);
+
+	// The probe's own reads are the same in every run, so only the differences are checked
+	timed(0);
+	base = probe.min;
+	CHECK_EQUAL(base, probe.max);
+	timed(10);
+	timed(5);
+	CHECK_EQUAL(3, probe.count);
+	CHECK_EQUAL(base, probe.min);
+	CHECK_EQUAL(base + 10 * SIM_IDLE_CYCLES, probe.max);
+	CHECK_EQUAL(3 * base + 15 * SIM_IDLE_CYCLES, probe.sum);
+
+	// The other probes are untouched
+	CHECK_EQUAL(0, prof_table[PROF_TIMER0].count);
+	CHECK_EQUAL(0, prof_table[PROF_ADC_ISR].count);
+}
+
+
+TEST(prof_count_saturates)
+{
+	PROF_PROBE &probe = prof_table[PROF_DISPLAY];
+	uint32 sum;
+
+	setup();
+	timed(1);
+	probe.count = 0xFFFE;
+	timed(2);
+	CHECK_EQUAL(0xFFFF, probe.count);
+	sum = probe.sum;
+
+	// Once the count stops, nothing else moves either, so the mean stays right
+	timed(20);
+	CHECK_EQUAL(0xFFFF, probe.count);
+	CHECK_EQUAL(sum, probe.sum);
+	CHECK(probe.max < 20 * SIM_IDLE_CYCLES);
+}
+
+
+TEST(prof_every)
+{
+	PROF_PROBE &probe = prof_table[PROF_ADC_ISR];
+	uint16 i;
+
+	setup();
+
+	// Only every PROF_ADC_EVERY th run is timed, the first of them the last of a full set
+	for (i = 1; i <= 5 * PROF_ADC_EVERY; i++)
+	{
+		PROF_ENTER_EVERY(PROF_ADC_ISR, PROF_ADC_EVERY);
+		if (probe.skip == 0)
+		{
+			sim_idle();
+		}
+		PROF_EXIT_EVERY(PROF_ADC_ISR);
+		CHECK_EQUAL(i / PROF_ADC_EVERY, probe.count);
+	}
+	CHECK_EQUAL(probe.min, probe.max);
+	CHECK(probe.min >= SIM_IDLE_CYCLES);
+
+	// Clearing starts the sampling over
+	prof_command('r');
+	CHECK_EQUAL(0, probe.count);
+	CHECK_EQUAL(0, probe.skip);
+	CHECK_EQUAL(0xFFFF, probe.min);
+}
+
+
+TEST(prof_table)
+{
+	std::string text;
+
+	setup();
+	uart_setup();
+	EA = 1;
+	timed(2);
+	timed(4);
+	prof_command('p');
+	while (!uart_idle())
+	{
+		sim_idle();
+	}
+
+	text.assign(test_uart.begin(), test_uart.end());
+	CHECK(text.find("probe,count,min_cycles,mean_cycles,max_cycles\r\n") == 0);
+	CHECK(text.find("display,2," + std::to_string(prof_table[PROF_DISPLAY].min) + "," +
+					std::to_string(prof_table[PROF_DISPLAY].min + SIM_IDLE_CYCLES) + "," +
+					std::to_string(prof_table[PROF_DISPLAY].max) + "\r\n") != std::string::npos);
+	CHECK(text.find("adc_isr,0,0,0,0\r\n") != std::string::npos);
+}
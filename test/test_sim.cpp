@@ -0,0 +1,33 @@
+// The simulator itself, the other tests rely on its timing
+
+#include "test/test.h"
+#include "hal.h"
+#include "config.h"
+#include "measurements.h"
+
+static uint64_t timer0_calls;
+
+static void count_timer0()
+{
+	timer0_calls = sim_isr_calls(1);
+}
+
+
+TEST(sim_timer0_rate)
+{
+	test_sim("-t 1.5");
+	sim_at(0.5, count_timer0);
+	test_run();
+
+	CHECK_NEAR(1.5, sim_time(), 1e-6);
+	CHECK_NEAR((double) F_OSC / TIMER0_CYCLES, (double) (sim_isr_calls(1) - timer0_calls), 1);
+}
+
+
+TEST(sim_dc_reading)
+{
+	test_sim("-t 1.5 -s 01 -a 2:dc:1234");
+	test_run();
+
+	CHECK_TEXT(" 1.234  V", sim_display());
+}
@@ -0,0 +1,120 @@
+// stats.c against sums and deviations worked out in 64 bits and doubles on the host.
+
+#include <cmath>
+#include "test/test.h"
+#include "hal.h"
+#include "measurements.h"
+#include "stats.h"
+
+extern STATS xdata stats_table[];
+
+static uint32_t lcg;
+
+// Repeatable readings from base to base + spread - 1
+static uint32 reading(uint32 base, uint32 spread)
+{
+	lcg = lcg * 1664525u + 1013904223u;
+	return base + (uint32) ((uint64_t) (lcg >> 2) * spread >> 30);
+}
+
+
+struct reference
+{
+	long long count;
+	long long sum;
+	double mean;
+	double m2;
+};
+
+static void add(reference &r, uint32 value)
+{
+	double delta = value - r.mean;
+
+	r.count++;
+	r.sum += value;
+	r.mean += delta / r.count;
+	r.m2 += delta * (value - r.mean);
+}
+
+
+// The rounded mean and the deviation in 1/16 units of the readings so far, the deviation
+// to relative of the reference
+static void check_against(const reference &r, double relative)
+{
+	CHECK_EQUAL((r.sum * 2 + r.count) / (r.count * 2), stats_mean(FREQ_MODE));
+	CHECK_NEAR(16 * std::sqrt(r.m2 / r.count), stats_deviation(FREQ_MODE),
+			   16 * std::sqrt(r.m2 / r.count) * relative + 1);
+}
+
+
+static void run(uint32 base, uint32 spread, long updates, double relative)
+{
+	reference r = {0, 0, 0, 0};
+
+	lcg = 12345;
+	stats_clear();
+	for (long i = 1; i <= updates; i++)
+	{
+		uint32 value = reading(base, spread);
+
+		stats_update(FREQ_MODE, value);
+		add(r, value);
+		if (i % (updates / 8) == 0)
+		{
+			check_against(r, relative);
+		}
+	}
+	CHECK_EQUAL(updates, stats_table[1].count);
+}
+
+
+// The mean stays exact and the variance with it, with no drift towards the latest readings
+TEST(stats_stable_over_millions)
+{
+	run(1000000, 1 << 20, 4000000, 1e-3);
+}
+
+
+// 10 MHz in 0.01 Hz with a 50 Hz spread, past what a clipped Q8 deviation could hold
+TEST(stats_deviation_wide)
+{
+	run(1000000000, 5000, 1000000, 1e-3);
+	run(0, 1 << 29, 1000000, 1e-3);
+}
+
+
+TEST(stats_deviation_small)
+{
+	stats_clear();
+	for (int i = 0; i < 1000; i++)
+	{
+		stats_update(FREQ_MODE, 5000 + (i & 1));
+	}
+	CHECK_EQUAL(5001, stats_mean(FREQ_MODE));
+	CHECK_EQUAL(8, stats_deviation(FREQ_MODE));
+
+	stats_clear();
+	for (int i = 0; i < 1000; i++)
+	{
+		stats_update(FREQ_MODE, 123456);
+	}
+	CHECK_EQUAL(123456, stats_mean(FREQ_MODE));
+	CHECK_EQUAL(0, stats_deviation(FREQ_MODE));
+
+	run(700, 3, 100000, 1e-3);
+}
+
+
+// Readings far apart are averaged like any others, the mean does not start over
+TEST(stats_far_apart)
+{
+	stats_clear();
+	stats_update(FREQ_MODE, 10);
+	stats_update(FREQ_MODE, 10 + (1L << 29));
+	stats_update(FREQ_MODE, 10);
+	stats_update(FREQ_MODE, 10 + (1L << 29));
+	CHECK_EQUAL(10 + (1L << 28), stats_mean(FREQ_MODE));
+	CHECK_NEAR(16.0 * (1L << 28), stats_deviation(FREQ_MODE), 16.0 * (1L << 28) * 1e-4);
+	CHECK_EQUAL(10, stats_table[1].min);
+	CHECK_EQUAL(10 + (1L << 29), stats_table[1].max);
+}
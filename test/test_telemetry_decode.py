@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Round trip of the telemetry frames through tools/telemetry_decode.py, run by make test.
+
+    test/test_telemetry_decode.py build/host/instrument
+
+Frames made here to the layout of telemetry.h are decoded among noise and damaged frames,
+then the simulated firmware's own readings and traces are decoded, by frames() and by the
+command line tool.
+"""
+
+import io
+import os
+import subprocess
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools"))
+from telemetry_decode import BLOCK, READING, TRACE, frames  # noqa: E402
+
+TOOL = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools", "telemetry_decode.py")
+INSTRUMENT = "build/host/instrument"
+DC_MODE = 0x01
+
+
+def encode(kind, ticks, payload):
+    body = bytes([kind, len(payload)]) + ticks.to_bytes(4, "big") + payload
+    return b"\xA5\x5A" + body + bytes([-sum(body) & 0xFF])
+
+
+def decode(data):
+    stats = {"frames": 0, "bad": 0, "skipped": 0}
+    return [(kind, ticks, bytes(payload)) for kind, ticks, payload in frames(io.BytesIO(data), stats)], stats
+
+
+def simulate(*options):
+    with tempfile.NamedTemporaryFile(suffix=".bin") as capture:
+        subprocess.run([INSTRUMENT, "-q", "-u", capture.name] + list(options), check=True,
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        with open(capture.name, "rb") as f:
+            return f.read()
+
+
+class Frames(unittest.TestCase):
+    def test_round_trip(self):
+        sent = [(READING, 0, bytes([DC_MODE]) + (1234).to_bytes(4, "big")),
+                (BLOCK, 0x01020304, bytes(range(6 + 64))),
+                (TRACE, 0xFFFFFFFF, bytes(8 + 2 * 32)),
+                (READING, 7, bytes([0x02, 0xFF, 0xFF, 0xFF, 0xFF]))]
+        data = b"".join(encode(*frame) for frame in sent)
+        self.assertEqual(decode(data)[0], sent)
+
+    def test_noise_and_damage(self):
+        good = encode(READING, 42, bytes([DC_MODE, 0, 0, 4, 210]))
+        damaged = bytearray(good)
+        damaged[9] ^= 0x10
+        # Text, a lone sync, a frame with a bad checksum and one cut short around two good ones
+        data = b"dc,3,1,2\n\xA5" + good + bytes(damaged) + b"\xA5\x5A" + good + good[:5]
+        decoded, stats = decode(data)
+        self.assertEqual(decoded, [(READING, 42, bytes([DC_MODE, 0, 0, 4, 210]))] * 2)
+        self.assertEqual(stats["frames"], 2)
+        self.assertGreaterEqual(stats["bad"], 1)
+
+    def test_sync_inside_payload(self):
+        sent = [(BLOCK, 1, bytes([0xA5, 0x5A] * 20)), (READING, 2, bytes([DC_MODE, 0xA5, 0x5A, 0xA5, 0x5A]))]
+        self.assertEqual(decode(b"".join(encode(*frame) for frame in sent))[0], sent)
+
+
+class Firmware(unittest.TestCase):
+    def test_readings_off_at_reset(self):
+        self.assertEqual(decode(simulate("-t", "1", "-s", "01"))[0], [])
+
+    def test_readings(self):
+        decoded, stats = decode(simulate("-t", "2", "-s", "01", "-a", "2:dc:1234", "-r", "t@0.05"))
+        readings = [int.from_bytes(p[1:5], "big") for kind, _, p in decoded if kind == READING and p[0] == DC_MODE]
+        self.assertGreater(len(readings), 10)
+        self.assertTrue(all(abs(v - 1234) <= 1 for v in readings), readings)
+        self.assertEqual(stats["bad"], 0)
+        self.assertEqual(stats["skipped"], 0)
+
+    def test_tool(self):
+        with tempfile.TemporaryDirectory() as directory:
+            capture = os.path.join(directory, "capture.bin")
+            traces = os.path.join(directory, "traces.csv")
+            with open(capture, "wb") as f:
+                f.write(simulate("-t", "2", "-s", "20", "-a", "1:square:100:2000:1250", "-r", "t@0.05"))
+            out = subprocess.run([sys.executable, TOOL, capture, "--traces", traces], check=True,
+                                 stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, universal_newlines=True).stdout
+            lines = out.splitlines()
+            self.assertEqual(lines[0], "time_s,mode,value,unit")
+            self.assertTrue(any(line.endswith(",capture,3999,mVpp") or line.endswith(",capture,4000,mVpp")
+                                for line in lines[1:]), lines)
+            with open(traces) as f:
+                rows = [line.strip().split(",") for line in f]
+            self.assertGreater(len(rows), 0)
+            for row in rows:
+                self.assertEqual(len(row), 4 + 256)
+                samples = [int(v) for v in row[4:]]
+                self.assertTrue(all(0 <= v <= 4095 for v in samples))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) > 1 and not sys.argv[-1].startswith("-"):
+        INSTRUMENT = sys.argv.pop()
+    unittest.main()
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""Compares amplitude readings of two simulator builds over a frequency sweep.
+
+    make host
+    make host HOST_DIR=build/fixed HOST_DEFINES=-DAMP_EDGE_SYNC=0
+    tools/amp_sweep.py build/host/instrument build/fixed/instrument [--mvpp MV] [--noise LSB]
+
+Each build measures a sine on the amplitude channel at every frequency from 1 Hz to 20 kHz.
+The readings come back as telemetry, and for each build the table shows the mean and worst
+error against the expected reading and the readings per simulated second. The first reading
+is left out, it may have been started before the input settled.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from telemetry_decode import READING, frames  # noqa: E402
+
+FREQUENCIES = [1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000]
+AMP_MODE = 0x04
+CIRCUIT_GAIN = 2        # amplitude_poll() doubles the span, see the comment there
+
+
+def readings(binary, hz, mvpp, noise, seconds):
+    with tempfile.NamedTemporaryFile(suffix=".bin") as capture:
+        subprocess.run([binary, "-q", "-t", str(seconds), "-s", "04", "-r", "t@0.05", "-n", str(noise),
+                        "-a", "1:sine:%g:%g:1250" % (hz, mvpp), "-u", capture.name],
+                       check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        with open(capture.name, "rb") as f:
+            stats = {"frames": 0, "bad": 0, "skipped": 0}
+            return [int.from_bytes(p[1:5], "big") for kind, _, p in frames(f, stats)
+                    if kind == READING and len(p) == 5 and p[0] == AMP_MODE]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("builds", nargs="+", help="simulator binaries to compare")
+    parser.add_argument("--mvpp", type=float, default=2000, help="input peak to peak, default 2000")
+    parser.add_argument("--noise", type=float, default=1, help="noise in LSB rms, default 1")
+    args = parser.parse_args()
+
+    expected = CIRCUIT_GAIN * args.mvpp
+    print("%8s" % "hz" + "".join("  %-28s" % os.path.basename(os.path.dirname(b)) for b in args.builds))
+    print("%8s" % "" + "  %8s %8s %10s" % ("mean%", "worst%", "reads/s") * len(args.builds))
+
+    for hz in FREQUENCIES:
+        seconds = 8 if hz < 10 else 3
+        row = "%8g" % hz
+        for binary in args.builds:
+            values = readings(binary, hz, args.mvpp, args.noise, seconds)[1:]
+            if not values:
+                row += "  %8s %8s %10.2f" % ("-", "-", 0)
+                continue
+            errors = [100.0 * abs(v - expected) / expected for v in values]
+            row += "  %8.2f %8.2f %10.2f" % (sum(errors) / len(errors), max(errors), len(values) / seconds)
+        print(row, flush=True)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Compares two benchmark tables written by bench.c and flags regressions.
+
+    tools/bench_compare.py baseline.csv new.csv [--tolerance PERCENT]
+
+A routine regresses when its mean or max cycles grow, or its samples per second drop,
+by more than the tolerance (default 5%). The exit status is 1 if anything regressed, so
+the script can gate a build. Rows only in one of the tables are listed but not failed.
+
+Only tables taken on the target, with *_cycles columns, gate. The simulator's tables have
+*_access_cycles columns, time charged for SFR accesses and not for code, so changes in them
+are listed as "changed" and the exit status stays 0. Two tables in different units are
+not compared at all, exit status 2.
+"""
+
+import argparse
+import csv
+import sys
+
+
+def load(path):
+    """The rows by routine and the units of the time columns."""
+    with open(path, newline="") as f:
+        reader = csv.DictReader(f)
+        rows = {row["routine"]: row for row in reader}
+    mean = [name for name in reader.fieldnames if name.startswith("mean_")]
+    if len(mean) != 1:
+        sys.exit("%s: no mean_ column, not a bench.c table" % path)
+    return rows, mean[0][len("mean_"):]
+
+
+def change(old, new):
+    """Relative change in percent, None when either side is missing or zero."""
+    if not old or not new or float(old) == 0:
+        return None
+    return 100.0 * (float(new) - float(old)) / float(old)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("new")
+    parser.add_argument("--tolerance", type=float, default=5.0, help="percent, default 5")
+    args = parser.parse_args()
+
+    baseline, units = load(args.baseline)
+    new, new_units = load(args.new)
+    if units != new_units:
+        print("%s is in %s and %s in %s, not comparable" % (args.baseline, units, args.new, new_units),
+              file=sys.stderr)
+        return 2
+    gate = units == "cycles"
+    if not gate:
+        print("%s are simulator SFR access time, not core cycles: listed, not gated" % units)
+    regressed = False
+
+    print("%-24s %10s %10s %8s %10s %8s  %s" % ("routine", "mean", "max", "mean%", "samples/s", "rate%", ""))
+    for name in list(baseline) + [n for n in new if n not in baseline]:
+        if name not in new or name not in baseline:
+            print("%-24s %s" % (name, "only in " + ("baseline" if name in baseline else "new")))
+            continue
+
+        old_row, new_row = baseline[name], new[name]
+        mean = change(old_row["mean_" + units], new_row["mean_" + units])
+        worst = change(old_row["max_" + units], new_row["max_" + units])
+        rate = change(old_row["samples_per_s"], new_row["samples_per_s"])
+
+        flag = ((mean is not None and mean > args.tolerance) or
+                (worst is not None and worst > args.tolerance) or
+                (rate is not None and rate < -args.tolerance))
+        regressed |= flag
+
+        print("%-24s %10s %10s %8s %10s %8s  %s" % (
+            name, new_row["mean_" + units], new_row["max_" + units],
+            "" if mean is None else "%+.1f" % mean,
+            new_row["samples_per_s"],
+            "" if rate is None else "%+.1f" % rate,
+            ("REGRESSED" if gate else "changed") if flag else ""))
+
+    return 1 if regressed and gate else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
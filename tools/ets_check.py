@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Checks the equivalent time sampled traces of amplitude mode against the simulator input.
+
+    make host
+    tools/ets_check.py build/host/instrument [--compare BINARY] [--mvpp MV] [--noise LSB]
+
+Above ~2.2 kHz amplitude mode builds one period of the input from one conversion per edge,
+and sends it as a trace. For each waveform and frequency the simulator is run and every
+trace is compared with the input: the peak to peak of the trace and of the reading against
+the input, and for sines the rms difference from the best fitting sine. A trace is one
+period long, so the fit is the fundamental of its discrete Fourier transform.
+
+--compare runs a second build, such as one made with HOST_DEFINES=-DAMP_ETS=0, and shows
+the error of its readings alongside. The 34.56 and 69.12 kHz cases are a 1/8 and 1/4 of the
+conversion rate, where conversions without the delays only ever land on a few phases.
+"""
+
+import argparse
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from telemetry_decode import READING, TRACE, frames  # noqa: E402
+
+CASES = [("sine", hz) for hz in (3000, 5000, 10000, 20000, 34560, 50000, 69120, 100000, 200000)] + \
+        [("triangle", 20000), ("square", 20000)]
+AMP_MODE = 0x04
+CIRCUIT_GAIN = 2        # amplitude_poll() doubles the span
+VREF_MV = 2500.0
+COUNTS = 4096
+OFFSET_MV = 1250
+
+
+def run(binary, kind, hz, mvpp, noise):
+    """Returns the amplitude readings and the traces, in mV, of one run."""
+    with tempfile.NamedTemporaryFile(suffix=".bin") as capture:
+        subprocess.run([binary, "-q", "-t", "1", "-s", "04", "-r", "tb@0.05", "-n", str(noise),
+                        "-a", "1:%s:%g:%g:%d" % (kind, hz, mvpp, OFFSET_MV), "-u", capture.name],
+                       check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        readings, traces, trace = [], [], None
+        with open(capture.name, "rb") as f:
+            for frame_kind, _, payload in frames(f, {"frames": 0, "bad": 0, "skipped": 0}):
+                if frame_kind == READING and len(payload) == 5 and payload[0] == AMP_MODE:
+                    readings.append(int.from_bytes(payload[1:5], "big"))
+                elif frame_kind == TRACE and len(payload) >= 8:
+                    size = int.from_bytes(payload[2:4], "big")
+                    if int.from_bytes(payload[4:6], "big") == 0:
+                        trace = []
+                    if trace is None:
+                        continue
+                    trace += [int.from_bytes(payload[i:i + 2], "big") * VREF_MV / COUNTS
+                              for i in range(8, len(payload), 2)]
+                    if len(trace) >= size:
+                        traces.append(trace)
+                        trace = None
+        return readings, traces
+
+
+def sine_residual(trace):
+    """rms difference in mV between a trace and the sine that fits it best."""
+    n = len(trace)
+    mean = sum(trace) / n
+    a = 2.0 / n * sum(v * math.cos(2 * math.pi * k / n) for k, v in enumerate(trace))
+    b = 2.0 / n * sum(v * math.sin(2 * math.pi * k / n) for k, v in enumerate(trace))
+    fit = [mean + a * math.cos(2 * math.pi * k / n) + b * math.sin(2 * math.pi * k / n) for k in range(n)]
+    return math.sqrt(sum((v - f) ** 2 for v, f in zip(trace, fit)) / n)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("binary")
+    parser.add_argument("--compare", help="second build, only its readings are checked")
+    parser.add_argument("--mvpp", type=float, default=2000, help="input peak to peak, default 2000")
+    parser.add_argument("--noise", type=float, default=1, help="noise in LSB rms, default 1")
+    args = parser.parse_args()
+
+    expected = CIRCUIT_GAIN * args.mvpp
+    print("%-9s %8s %7s %12s %12s %12s %12s" %
+          ("wave", "hz", "traces", "trace_vpp%", "reading%", "sine_rms_mv", "compare%"))
+    failed = False
+    for kind, hz in CASES:
+        readings, traces = run(args.binary, kind, hz, args.mvpp, args.noise)
+        compare = "%12s" % "-"
+        if args.compare:
+            others = run(args.compare, kind, hz, args.mvpp, args.noise)[0][1:]
+            if others:
+                compare = "%12.2f" % max(100.0 * abs(r - expected) / expected for r in others)
+        if not traces or not readings:
+            print("%-9s %8g %7d  no traces" % (kind, hz, len(traces)))
+            failed = True
+            continue
+
+        # Worst of every trace and every reading but the first
+        vpp = max(100.0 * abs(max(t) - min(t) - args.mvpp) / args.mvpp for t in traces)
+        reading = max(100.0 * abs(r - expected) / expected for r in readings[1:] or readings)
+        residual = "%12.2f" % max(sine_residual(t) for t in traces) if kind == "sine" else "%12s" % "-"
+        print("%-9s %8g %7d %12.2f %12.2f %s %s" % (kind, hz, len(traces), vpp, reading, residual, compare))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
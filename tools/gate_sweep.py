@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Shows how the frequency mode gate adapts to the input, in the simulator.
+
+    make host
+    tools/gate_sweep.py build/host/instrument [--seconds S]
+    tools/gate_sweep.py build/host/instrument --step 50000:2000@3 [--seconds S]
+
+Without --step a sine is measured at every frequency from 1 Hz to 2 MHz. For each one the
+table shows the readings per simulated second, the time between the last two readings,
+which is the gate the scheduler settled on, and the mean and worst error of the readings
+in ppm. The first reading is left out, it comes from the shortest gate.
+
+--step FROM:TO@SECONDS changes the input frequency at a time and prints every reading, so
+the gate can be followed as it lengthens or shortens after the step.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from telemetry_decode import READING, TICK_S, frames  # noqa: E402
+
+FREQUENCIES = [1, 3, 10, 50, 200, 900, 1500, 5000, 20000, 100000, 500000, 2000000]
+FREQ_MODE = 0x02
+SINE = "1:sine:%g:2000:1250"
+
+
+def readings(binary, inputs, seconds):
+    """(time_s, Hz) of every frequency reading."""
+    args = [binary, "-q", "-t", str(seconds), "-s", "02", "-r", "t@0.05"]
+    for spec in inputs:
+        args += ["-a", spec]
+    with tempfile.NamedTemporaryFile(suffix=".bin") as capture:
+        subprocess.run(args + ["-u", capture.name], check=True,
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        with open(capture.name, "rb") as f:
+            stats = {"frames": 0, "bad": 0, "skipped": 0}
+            return [(ticks * TICK_S, int.from_bytes(p[1:5], "big") / 100.0)
+                    for kind, ticks, p in frames(f, stats)
+                    if kind == READING and len(p) == 5 and p[0] == FREQ_MODE]
+
+
+def sweep(binary, seconds):
+    print("%9s %8s %8s %10s %10s" % ("hz", "reads/s", "gate_s", "mean_ppm", "worst_ppm"))
+    for hz in FREQUENCIES:
+        values = readings(binary, [SINE % hz], seconds)[1:]
+        if len(values) < 2:
+            print("%9g %8.2f %8s %10s %10s" % (hz, len(values) / seconds, "-", "-", "-"), flush=True)
+            continue
+        errors = [1e6 * abs(v - hz) / hz for _, v in values]
+        print("%9g %8.2f %8.2f %10.1f %10.1f" % (hz, len(values) / seconds, values[-1][0] - values[-2][0],
+                                                 sum(errors) / len(errors), max(errors)), flush=True)
+
+
+def step(binary, spec, seconds):
+    frequencies, at = spec.split("@")
+    start, end = (float(v) for v in frequencies.split(":"))
+    values = readings(binary, [SINE % start, SINE % end + "@" + at], seconds)
+    print("%8s %8s %14s" % ("time_s", "gate_s", "hz"))
+    last = 0.0
+    for time_s, hz in values:
+        print("%8.2f %8.2f %14.2f" % (time_s, time_s - last, hz))
+        last = time_s
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("binary")
+    parser.add_argument("--step", help="FROM:TO@SECONDS, a frequency step instead of the sweep")
+    parser.add_argument("--seconds", type=float, default=15, help="simulated time per run, default 15")
+    args = parser.parse_args()
+
+    if args.step:
+        step(args.binary, args.step, args.seconds)
+    else:
+        sweep(args.binary, args.seconds)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Plots the capture mode traces written by telemetry_decode.py --traces.
+
+    tools/plot_trace.py traces.csv [--trace N] [--png FILE]
+
+Each line of the file is time_s,channel,trace,trigger,samples... with the samples in ADC
+counts. The last trace is drawn unless --trace picks one by its number, in mV against the
+time from the trigger. matplotlib draws it when installed, otherwise a text plot is printed
+so a trace can still be checked over a terminal.
+"""
+
+import argparse
+import sys
+
+VREF_MV = 2500.0
+COUNTS = 4096
+
+
+def load(path, number):
+    chosen = None
+    with open(path) as f:
+        for line in f:
+            fields = line.strip().split(",")
+            if len(fields) < 5:
+                continue
+            trace = (float(fields[0]), int(fields[1]), int(fields[2]), int(fields[3]),
+                     [int(v) * VREF_MV / COUNTS for v in fields[4:]])
+            if number is None or trace[2] == number:
+                chosen = trace
+    return chosen
+
+
+def text_plot(trace, width=64, height=16):
+    time_s, channel, number, trigger, mv = trace
+    low, high = min(mv), max(mv)
+    span = (high - low) or 1.0
+    step = max(len(mv) // width, 1)
+    columns = [mv[i] for i in range(0, len(mv), step)]
+
+    rows = [[" "] * len(columns) for _ in range(height)]
+    for x, v in enumerate(columns):
+        rows[height - 1 - int((v - low) * (height - 1) / span)][x] = "*"
+    marker = min(trigger // step, len(columns) - 1)
+    for row in rows:
+        if row[marker] == " ":
+            row[marker] = "|"
+
+    print("trace %d, channel %d at %.2f s, trigger at sample %d" % (number, channel, time_s, trigger))
+    for i, row in enumerate(rows):
+        level = high - i * span / (height - 1)
+        print("%7.1f mV %s" % (level, "".join(row)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("traces")
+    parser.add_argument("--trace", type=int, help="trace number, default the last one")
+    parser.add_argument("--png", help="save the plot here instead of showing it")
+    args = parser.parse_args()
+
+    trace = load(args.traces, args.trace)
+    if trace is None:
+        print("no trace found", file=sys.stderr)
+        return 1
+
+    try:
+        import matplotlib
+        if args.png:
+            matplotlib.use("Agg")
+        import matplotlib.pyplot as plt
+    except ImportError:
+        text_plot(trace)
+        return 0
+
+    time_s, channel, number, trigger, mv = trace
+    plt.plot([i - trigger for i in range(len(mv))], mv)
+    plt.axvline(0, linestyle=":")
+    plt.xlabel("samples from trigger")
+    plt.ylabel("mV")
+    plt.title("trace %d, channel %d at %.2f s" % (number, channel, time_s))
+    if args.png:
+        plt.savefig(args.png)
+    else:
+        plt.show()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Decodes the binary telemetry frames sent by telemetry.c.
+
+    tools/telemetry_decode.py SOURCE [--blocks FILE] [--traces FILE]
+
+SOURCE is a capture file, a serial device (set to 115200 8N1 raw) or - for stdin, so a
+live stream can be followed or the output of the simulator decoded afterwards:
+
+    build/host/instrument -s 04 -r t@0.05 -r b@0.5 -u capture.bin
+    tools/telemetry_decode.py capture.bin --blocks blocks.csv
+
+Readings, sent once 't' turns them on, are printed as CSV, time_s,mode,value,unit. Raw
+amplitude blocks, sent once 'b' turns them on, are put back together from their frames and
+written one per line to --blocks as time_s,channel,block,samples... Capture mode traces go
+to --traces the same way as time_s,channel,trace,trigger,samples..., see
+tools/plot_trace.py. Bytes that are not part of a valid frame, such as the text of a
+profile dump, are skipped.
+"""
+
+import argparse
+import os
+import sys
+
+SYNC = b"\xA5\x5A"
+HEADER = 8
+TICK_S = 442 * 250 / 11059200.0     # scheduler tick, TICK_INTS with the defaults of config.h
+
+READING = 0x01
+BLOCK = 0x02
+TRACE = 0x03
+
+# mode: name, unit, decimal places of the value
+MODES = {0x01: ("dc", "mV", 0), 0x02: ("freq", "Hz", 2), 0x04: ("amp", "mVpp", 0), 0x08: ("rms", "mV", 0),
+         0x10: ("scan", "mV", 0), 0x20: ("capture", "mVpp", 0)}
+
+
+def open_source(path):
+    if path == "-":
+        return sys.stdin.buffer
+    f = open(path, "rb", buffering=0)
+    if os.isatty(f.fileno()):
+        import termios
+        import tty
+        tty.setraw(f.fileno())
+        attrs = termios.tcgetattr(f.fileno())
+        attrs[4] = attrs[5] = termios.B115200
+        termios.tcsetattr(f.fileno(), termios.TCSANOW, attrs)
+    return f
+
+
+def frames(source, stats):
+    """Yields (type, time ticks, payload) for every frame with a good checksum."""
+    buffer = bytearray()
+    done = False
+    while not done:
+        data = source.read(4096)
+        done = not data
+        buffer += data
+
+        while True:
+            start = buffer.find(SYNC)
+            if start < 0:
+                kept = 0 if done else 1     # may be the first half of a sync
+                stats["skipped"] += max(len(buffer) - kept, 0)
+                del buffer[:len(buffer) - kept]
+                break
+            stats["skipped"] += start
+            del buffer[:start]
+            end = HEADER + buffer[3] + 1 if len(buffer) >= HEADER else HEADER
+            if len(buffer) < end:
+                if not done:
+                    break
+                # The stream ended inside it, it may have been a stray sync before a frame
+                stats["skipped"] += 1
+                del buffer[:1]
+                continue
+
+            if sum(buffer[2:end]) & 0xFF:
+                stats["bad"] += 1
+                del buffer[:1]      # not a frame after all, look for the next sync
+                continue
+
+            stats["frames"] += 1
+            yield buffer[2], int.from_bytes(buffer[4:8], "big"), bytes(buffer[HEADER:end - 1])
+            del buffer[:end]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source")
+    parser.add_argument("--blocks", help="write reassembled raw blocks here")
+    parser.add_argument("--traces", help="write reassembled capture traces here")
+    args = parser.parse_args()
+
+    stats = {"frames": 0, "bad": 0, "skipped": 0, "blocks": 0}
+    outputs = {BLOCK: open(args.blocks, "w") if args.blocks else None,
+               TRACE: open(args.traces, "w") if args.traces else None}
+    block = None        # (time, channel, number, samples, prefix) being put together
+
+    print("time_s,mode,value,unit")
+    try:
+        for kind, ticks, payload in frames(open_source(args.source), stats):
+            time_s = ticks * TICK_S
+
+            if kind == READING and len(payload) == 5:
+                mode, unit, places = MODES.get(payload[0], ("none", "", 0))
+                value = int.from_bytes(payload[1:5], "big")
+                print("%.2f,%s,%.*f,%s" % (time_s, mode, places, value / 10 ** places, unit),
+                      flush=True)
+
+            elif kind in (BLOCK, TRACE) and len(payload) >= 6:
+                channel, number = payload[0], payload[1]
+                size = int.from_bytes(payload[2:4], "big")
+                offset = int.from_bytes(payload[4:6], "big")
+                first = 6
+                prefix = ""
+                if kind == TRACE:
+                    prefix = ",%d" % int.from_bytes(payload[6:8], "big")
+                    first = 8
+                samples = [int.from_bytes(payload[i:i + 2], "big") for i in range(first, len(payload), 2)]
+
+                # A block is only kept if every frame of it arrives in order
+                if offset == 0:
+                    block = (time_s, channel, number, [], prefix, kind)
+                if block is None or block[2] != number or block[5] != kind or len(block[3]) != offset:
+                    block = None
+                    continue
+                block[3].extend(samples)
+
+                if len(block[3]) >= size:
+                    out = outputs[kind]
+                    if out:
+                        out.write("%.2f,%d,%d%s,%s\n" % (block[0], block[1], block[2], block[4],
+                                                         ",".join(str(v) for v in block[3])))
+                        out.flush()
+                    stats["blocks"] += 1
+                    block = None
+    except KeyboardInterrupt:
+        pass
+
+    print("%d frames, %d blocks, %d bad checksums, %d bytes skipped" %
+          (stats["frames"], stats["blocks"], stats["bad"], stats["skipped"]), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,6 +1,7 @@
 #ifndef TYPEDEF_HEADER_INCLUDED
 #define TYPEDEF_HEADER_INCLUDED
 
+#ifdef __C51__
 // type definitions for ADuC841, Keil compiler
 typedef unsigned       char uint8;
 typedef   signed       char  int8;
@@ -8,5 +9,15 @@ typedef unsigned short int  uint16;
 typedef   signed short int   int16;
 typedef unsigned long  int  uint32;
 typedef   signed long  int   int32;
+#else
+// host build, long is 64 bits there
+#include <stdint.h>
+typedef uint8_t  uint8;
+typedef int8_t    int8;
+typedef uint16_t uint16;
+typedef int16_t   int16;
+typedef uint32_t uint32;
+typedef int32_t   int32;
+#endif
 
 #endif
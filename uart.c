@@ -0,0 +1,167 @@
+#include "hal.h"
+#include "typedef.h"
+#include "uart.h"
+
+uint8 xdata uart_buffer[2][UART_BUFFER_SIZE];
+uint8 idata uart_length[2];	// bytes queued in each buffer, 0 while it is free
+uint8 idata uart_sending;	// buffer the ISR is sending
+uint8 idata uart_sent;		// bytes of it gone to SBUF
+bit   uart_busy;			// a buffer is being sent
+char  uart_received;		// last byte received, 0 once read
+
+
+// Serial interrupt, keeps SBUF fed from the queued buffers and catches received bytes
+HAL_ISR(uart_isr, 4)
+{
+	if(RI)
+	{
+		uart_received = SBUF;
+		RI = 0;
+	}
+	if(!TI)
+	{
+		return;
+	}
+	TI = 0;
+
+	if(++uart_sent < uart_length[uart_sending])
+	{
+		SBUF = uart_buffer[uart_sending][uart_sent];
+		return;
+	}
+
+	// Buffer done, free it and go on to the other one if it is queued
+	uart_length[uart_sending] = 0;
+	uart_sending ^= 1;
+	uart_sent = 0;
+	if(uart_length[uart_sending] != 0)
+	{
+		SBUF = uart_buffer[uart_sending][0];
+	}
+	else
+	{
+		uart_busy = 0;
+	}
+}
+
+
+void uart_setup()
+{
+	uart_length[0] = 0;
+	uart_length[1] = 0;
+	uart_sending = 0;
+	uart_sent = 0;
+	uart_busy = 0;
+	uart_received = 0;
+
+	// Timer 3 generates the baud rate, leaving timers 1 and 2 for the measurements
+	// F_OSC / (16 * 2^DIV * (1 + T3FD/64)), 11.0592 MHz gives 115200 with DIV = 2 and T3FD = 32
+	T3CON = 0x80 | UART_T3_DIV;	// T3BAUDEN
+	T3FD  = UART_T3FD;
+	SCON  = 0x50;	// mode 1, 8 data bits, receiver on
+	ES    = 1;		// serial interrupt
+	EA    = 1;
+}
+
+
+// Returns a buffer that is neither queued nor being sent, or 0
+uint8 xdata *uart_claim()
+{
+	// Only the ISR frees buffers, so a free one stays free until it is queued
+	if(uart_length[0] == 0)
+	{
+		return uart_buffer[0];
+	}
+	if(uart_length[1] == 0)
+	{
+		return uart_buffer[1];
+	}
+	return 0;
+}
+
+
+void uart_queue(uint8 xdata *buffer, uint8 length)
+{
+	uint8 i = (buffer == uart_buffer[1]);
+
+	if(length == 0)
+	{
+		return;
+	}
+
+	ES = 0;			// keep the ISR out while checking if it is idle
+	uart_length[i] = length;
+	if(!uart_busy)
+	{
+		uart_busy = 1;
+		uart_sending = i;
+		uart_sent = 0;
+		SBUF = buffer[0];	// the ISR sends the rest
+	}
+	ES = 1;
+}
+
+
+bit uart_idle()
+{
+	return !uart_busy;
+}
+
+
+void uart_putc(char c)
+{
+	uint8 xdata *buffer;
+
+	while((buffer = uart_claim()) == 0) HAL_IDLE();
+	buffer[0] = c;
+	uart_queue(buffer, 1);
+}
+
+
+// Sends a string a buffer at a time
+void uart_puts(const char *s)
+{
+	uint8 xdata *buffer;
+	uint8 n;
+
+	while(*s)
+	{
+		while((buffer = uart_claim()) == 0) HAL_IDLE();
+
+		for(n = 0; n < UART_BUFFER_SIZE && *s; n++)
+		{
+			buffer[n] = *s++;
+		}
+		uart_queue(buffer, n);
+	}
+}
+
+
+void uart_put_uint(uint32 value)
+{
+	char digits[11];
+	uint8 n = 10;
+
+	digits[10] = 0;
+	do
+	{
+		digits[--n] = '0' + value % 10;
+		value /= 10;
+	}
+	while(value != 0);
+
+	uart_puts(digits + n);
+}
+
+
+// Returns the byte received since the last call, or 0, never waits
+char uart_getc()
+{
+	char c;
+
+	ES = 0;
+	c = uart_received;
+	uart_received = 0;
+	ES = 1;
+	return c;
+}
@@ -0,0 +1,44 @@
+#ifndef UART_H
+#define UART_H
+
+#include "typedef.h"
+#include "config.h"
+
+#ifndef UART_BAUD
+#define UART_BAUD	115200L	// from timer 3, see uart_setup()
+#endif
+
+// Timer 3 divides the core clock by 2^DIV * (64 + T3FD) / 4 for the baud rate. DIV is the
+// largest that leaves T3FD at 0 to 63, T3FD is rounded to the nearest.
+#define UART_T3_RATIO	((4 * F_OSC + UART_BAUD / 2) / UART_BAUD)	// 2^DIV * (64 + T3FD)
+#define UART_T3_DIV		(UART_T3_RATIO >= 8192 ? 7 : UART_T3_RATIO >= 4096 ? 6 : \
+						 UART_T3_RATIO >= 2048 ? 5 : UART_T3_RATIO >= 1024 ? 4 : \
+						 UART_T3_RATIO >= 512 ? 3 : UART_T3_RATIO >= 256 ? 2 : \
+						 UART_T3_RATIO >= 128 ? 1 : 0)
+#define UART_T3FD		(((UART_T3_RATIO + (1 << UART_T3_DIV) / 2) >> UART_T3_DIV) - 64)
+#define UART_ACTUAL		(4 * F_OSC / ((64 + UART_T3FD) << UART_T3_DIV))
+
+#if UART_T3_RATIO < 64 || UART_T3_RATIO >= 16384 || UART_T3FD > 63
+#error "timer 3 cannot divide F_OSC down to UART_BAUD"
+#endif
+#if (UART_ACTUAL - UART_BAUD) * 50 > UART_BAUD || (UART_BAUD - UART_ACTUAL) * 50 > UART_BAUD
+#error "UART_BAUD is more than 2% from what timer 3 can make from F_OSC"
+#endif
+
+// Two transmit buffers, the serial ISR sends one while the other is filled.
+// Claim a free buffer, write up to UART_BUFFER_SIZE bytes and queue it.
+#define UART_BUFFER_SIZE	82
+
+void uart_setup();
+uint8 xdata *uart_claim();						// a free buffer, 0 if both are queued
+void uart_queue(uint8 xdata *buffer, uint8 length);	// hands a claimed buffer to the ISR
+bit uart_idle();								// nothing queued or being sent
+
+// Text output, waits for a free buffer
+void uart_putc(char c);
+void uart_puts(const char *s);
+void uart_put_uint(uint32 value);	// decimal, no leading zeros
+
+char uart_getc();					// byte received, 0 if nothing has arrived
+
+#endif